@@ -2484,10 +2484,17 @@ do_modelines()
 	if (chk_modeline(lnum) == FAIL)
 	    nmlines = 0;
 
-    for (lnum = curbuf->b_ml.ml_line_count; lnum > 0 && lnum > nmlines &&
+    /* When the file was not read completely the last lines in the buffer
+     * are not the last lines of the file.  Read the rest when there may be
+     * a modeline at the end, otherwise skip them. */
+    if (curbuf->b_ml.ml_lazy != NULL
+				 && readfile_lazy_modeline(curbuf, nmlines))
+	readfile_lazy(curbuf, (linenr_t)MAXLNUM);
+    if (curbuf->b_ml.ml_lazy == NULL)
+	for (lnum = curbuf->b_ml.ml_line_count; lnum > 0 && lnum > nmlines &&
 			  lnum > curbuf->b_ml.ml_line_count - nmlines; --lnum)
-	if (chk_modeline(lnum) == FAIL)
-	    nmlines = 0;
+	    if (chk_modeline(lnum) == FAIL)
+		nmlines = 0;
     --entered;
 }
 
@@ -476,8 +476,7 @@ do_move(line1, line2, dest)
     if (u_save(line1 + extra - 1, line2 + extra + 1) == FAIL)
 	return FAIL;
 
-    for (l = line1; l <= line2; l++)
-	ml_delete(line1 + extra, TRUE);
+    ml_delete_range(line1 + extra, (long)num_lines, TRUE);
 
     changed();
     if (!global_busy && num_lines > p_report)
@@ -2789,13 +2788,10 @@ do_change(start, end, getline, cookie, getl_break)
 	return;
 
     mark_adjust(start, end, (long)MAXLNUM, (long)(start - end - 1));
-    while (end >= start)
+    if (end >= start && !(curbuf->b_ml.ml_flags & ML_EMPTY))
     {
-	if (curbuf->b_ml.ml_flags & ML_EMPTY)	    /* nothing to delete */
-	    break;
-	ml_delete(start, FALSE);
+	ml_delete_range(start, (long)(end - start + 1), FALSE);
 	changed();
-	end--;
     }
     do_append(start - 1, getline, cookie, getl_break);
 }
@@ -752,6 +752,7 @@ do_one_cmd(cmdlinep, sourcing,
 	    if (*ea.cmd == '%')		    /* '%' - all lines */
 	    {
 		++ea.cmd;
+		readfile_lazy(curbuf, MAXLNUM);
 		ea.line1 = 1;
 		ea.line2 = curbuf->b_ml.ml_line_count;
 		++ea.addr_count;
@@ -1193,6 +1194,7 @@ do_one_cmd(cmdlinep, sourcing,
 
     if ((ea.argt & DFLALL) && ea.addr_count == 0)
     {
+	readfile_lazy(curbuf, MAXLNUM);	/* e.g. ":w" needs all lines */
 	ea.line1 = 1;
 	ea.line2 = curbuf->b_ml.ml_line_count;
     }
@@ -3137,6 +3139,7 @@ get_address(ptr, skip)
 
 	    case '$':			    /* '$' - last line */
 			++cmd;
+			readfile_lazy(curbuf, MAXLNUM);
 			lnum = curbuf->b_ml.ml_line_count;
 			break;
 
@@ -3292,6 +3295,8 @@ error:
 invalid_range(eap)
     EXARG	*eap;
 {
+    if (eap->line2 > curbuf->b_ml.ml_line_count)
+	readfile_lazy(curbuf, eap->line2);  /* may not have been read yet */
     if (       eap->line1 < 0
 	    || eap->line2 < 0
 	    || eap->line1 > eap->line2
@@ -28,7 +28,53 @@
 # include <proto/dos.h>		/* for Lock() and UnLock() */
 #endif
 
+/*
+ * Read-only files are mapped into memory, the lines are appended directly from
+ * the mapping instead of being read() into a buffer first.
+ */
+#if defined(UNIX) && defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# define USE_MMAP_READ
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void *)-1)
+# endif
+# if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#  define MAP_ANON MAP_ANONYMOUS
+# endif
+
+/*
+ * When a large file is mapped for a new buffer readfile() only appends the
+ * lines for the first screen, readfile_lazy() appends the rest when the user
+ * is idle or when the lines are needed.  The mapping is kept until then.
+ */
+struct lazyread
+{
+    char_u	*lr_map;	/* mapped file */
+    long	lr_size;	/* size of lr_map */
+    char_u	*lr_ptr;	/* first line not appended yet, NULL when the
+				   whole file was read */
+    int		lr_fileformat;	/* EOL_UNIX, EOL_DOS or EOL_MAC */
+};
+
+# define LAZY_READ_MIN		0x100000L   /* read lazily above this size */
+# define LAZY_READ_CHUNK	0x10000L    /* bytes appended at a time */
+
+/*
+ * When another process truncates a mapped file, accessing the part beyond
+ * the new end causes a SIGBUS.  While lines are appended from a mapping
+ * mmap_catch_bus() is the SIGBUS handler.  It replaces the mapping with
+ * zero-filled memory, so that the access can continue, and sets
+ * mmap_bus_error.  Reading stops there and the buffer is marked as not
+ * complete.
+ */
+static char_u	*mmap_guard_ptr = NULL;	/* mapping being read */
+static long	mmap_guard_size;	/* size of mmap_guard_ptr */
+static int	mmap_bus_error = FALSE;	/* SIGBUS caught */
+static RETSIGTYPE (*mmap_old_bus)();	/* previous SIGBUS handler */
+#endif
+
 #define BUFSIZE		8192	/* size of normal write buffer */
+#define APPEND_BATCH	64	/* lines readfile() appends at once */
 #define SMBUFSIZE	256	/* size of emergency write buffer */
 
 #ifdef CRYPTV
@@ -61,6 +107,17 @@ static int msg_add_fileformat __ARGS((int eol_type));
 static void msg_add_lines __ARGS((int, long, long));
 static void msg_add_eol __ARGS((void));
 static int check_mtime __ARGS((BUF *buf, struct stat *s));
+static int guess_fileformat __ARGS((char_u *ptr, long size, int try_dos, int try_unix, int try_mac));
+static int append_batch __ARGS((linenr_t lnum, char_u **lines, colnr_t *lens, int *countp, int newfile));
+#ifdef USE_MMAP_READ
+static int mmap_append __ARGS((linenr_t lnum, char_u *p, long len, int fileformat, int newfile));
+static long lazy_line_estimate __ARGS((struct lazyread *lazy, long linecnt));
+static void mmap_guard_start __ARGS((char_u *ptr, long size));
+static int mmap_guard_end __ARGS((void));
+# ifdef SIGBUS
+static RETSIGTYPE mmap_catch_bus __ARGS(SIGPROTOARG);
+# endif
+#endif
 static int time_differs __ARGS((long t1, long t2));
 #ifdef CRYPTV
 static int  write_buf __ARGS((int, char_u *, int, int));
@@ -104,7 +161,13 @@ filemess(buf, name, s, attr)
  *
  * 1. We allocate blocks with lalloc, as big as possible.
  * 2. Each block is filled with characters from the file with a single read().
- * 3. The lines are inserted in the buffer with ml_append().
+ * 3. The lines are inserted in the buffer with ml_append_lines(), a number
+ *    of lines at a time.
+ *
+ * When USE_MMAP_READ is defined a large file that is read into a readonly
+ * buffer is mapped into memory instead, and the lines are appended from
+ * the mapping.  For a very large file in a new buffer only the first lines
+ * are appended, see readfile_lazy().
  *
  * (caller must check that fname != NULL, unless READ_STDIN is used)
  *
@@ -169,6 +232,17 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, flags)
     int		try_mac = (vim_strchr(p_ffs, 'm') != NULL);
     int		try_dos = (vim_strchr(p_ffs, 'd') != NULL);
     int		try_unix = (vim_strchr(p_ffs, 'x') != NULL);
+    char_u	*app_lines[APPEND_BATCH];   /* lines for ml_append_lines() */
+    colnr_t	app_lens[APPEND_BATCH];
+    int		app_count = 0;		    /* nr of entries in app_lines */
+#ifdef USE_MMAP_READ
+    char_u	*mm_ptr = NULL;		/* mapped file contents */
+    long	mm_size = 0;		/* size of mm_ptr */
+    char_u	*eol;
+    struct lazyread *lazy = NULL;	/* for reading the rest later */
+    linenr_t	mm_good = 0;		/* lines appended before a SIGBUS */
+    int		lines_estimated = FALSE;	/* linecnt is a guess */
+#endif
 
 
 #ifdef AUTOCMD
@@ -487,12 +561,208 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, flags)
 	fileformat = EOL_UNKNOWN;	    /* detect from file */
     linecnt = curbuf->b_ml.ml_line_count;
 
+#ifdef USE_MMAP_READ
+    /*
+     * Map a large file into memory when it is going to be readonly.  Not when
+     * reading only part of the file (recovery) or when it is encrypted, the
+     * text would have to be changed in place.
+     */
+    if (!read_stdin && !filtering && (curbuf->b_p_ro || readonlymode)
+	    && lines_to_skip == 0 && lines_to_read == MAXLNUM
+	    && S_ISREG(perm) && fstat(fd, &st) >= 0
+	    && st.st_size > 0x10000L && (long)st.st_size == st.st_size)
+    {
+	mm_ptr = (char_u *)mmap(NULL, (size_t)st.st_size, PROT_READ,
+						   MAP_PRIVATE, fd, (off_t)0);
+	if ((void *)mm_ptr == MAP_FAILED)
+	    mm_ptr = NULL;
+	else
+	{
+	    mm_size = (long)st.st_size;
+# ifdef CRYPTV
+	    if (STRNCMP(mm_ptr, CRYPT_MAGIC, CRYPT_MAGIC_LEN) == 0)
+	    {
+		munmap((void *)mm_ptr, (size_t)mm_size);
+		mm_ptr = NULL;
+	    }
+	    /* Not encrypted: clear the 'key' option like below, except
+	     * starting up (called with -x argument). */
+	    else if (newfile && *curbuf->b_p_key && !starting)
+		set_option_value((char_u *)"key", 0L, (char_u *)"");
+# endif
+	}
+
+	/* For a very large file in an empty buffer append the lines for the
+	 * first screen now and the rest later. */
+	if (mm_ptr != NULL && newfile && wasempty && !recoverymode
+						  && mm_size > LAZY_READ_MIN)
+	    lazy = (struct lazyread *)alloc_clear(
+					     (unsigned)sizeof(struct lazyread));
+    }
+#endif
+
 retry:
     linerest = 0;
     filesize = 0;
     skip_count = lines_to_skip;
     read_count = lines_to_read;
 
+#ifdef USE_MMAP_READ
+    if (mm_ptr != NULL)
+    {
+	/*
+	 * Find the line breaks with memchr() and append each line from the
+	 * mapping.  The mapping can't be changed, thus the last line is also
+	 * handled here.
+	 */
+	filesize = mm_size;
+	ptr = mm_ptr;
+	if (fileformat == EOL_UNKNOWN)
+	{
+	    fileformat = guess_fileformat(ptr,
+			     mm_size > 0x10000L ? 0x10000L : mm_size,
+			     try_dos, try_unix, try_mac);
+	    if (newfile)
+		set_fileformat(fileformat);
+	}
+	line_start = ptr;
+	mmap_guard_start(mm_ptr, mm_size);
+	mm_good = lnum;
+	while (ptr < mm_ptr + mm_size && !got_int)
+	{
+	    eol = (char_u *)memchr(ptr, fileformat == EOL_MAC ? CR : NL,
+					      (size_t)(mm_ptr + mm_size - ptr));
+	    if (eol == NULL || mmap_bus_error)
+		break;
+	    len = eol - ptr;
+	    if (fileformat == EOL_DOS)
+	    {
+		if (len > 0 && eol[-1] == CR)	/* remove CR */
+		    --len;
+		/*
+		 * Reading in Dos format, but no CR-LF found!
+		 * When 'fileformats' includes "unix", delete all the lines
+		 * read so far and start all over again.  Otherwise give an
+		 * error message later.
+		 */
+		else if (ff_error != EOL_DOS)
+		{
+		    if (try_unix)
+		    {
+			lnum -= app_count;	/* drop the collected lines */
+			app_count = 0;
+			while (lnum > from)
+			    ml_delete(lnum--, FALSE);
+			fileformat = EOL_UNIX;
+			if (newfile)
+			    set_fileformat(EOL_UNIX);
+			goto retry;
+		    }
+		    ff_error = EOL_DOS;
+		}
+	    }
+	    if (memchr(ptr, NUL, (size_t)len) == NULL
+		    && (fileformat != EOL_MAC
+				     || memchr(ptr, NL, (size_t)len) == NULL))
+	    {
+		/* can use the text as-is, ml_append_lines() adds the NUL */
+		app_lines[app_count] = ptr;
+		app_lens[app_count++] = len + 1;
+	    }
+	    else if (append_batch(lnum, app_lines, app_lens, &app_count,
+							      newfile) == FAIL
+		    || mmap_append(lnum, ptr, (long)len, fileformat,
+							      newfile) == FAIL)
+	    {
+		error = TRUE;
+		break;
+	    }
+	    ++lnum;
+	    if (app_count == APPEND_BATCH && append_batch(lnum, app_lines,
+					 app_lens, &app_count, newfile) == FAIL)
+	    {
+		error = TRUE;
+		break;
+	    }
+	    if (mmap_bus_error)
+		break;
+	    mm_good = lnum - app_count;	/* appended lines are complete */
+	    ptr = eol + 1;
+	    if (ptr - line_start >= 0x10000L)
+	    {
+		line_start = ptr;
+		ui_breakcheck();
+	    }
+
+	    /* Enough for the first screen, leave the rest for
+	     * readfile_lazy(). */
+	    if (lazy != NULL && ptr - mm_ptr >= LAZY_READ_CHUNK
+						   && lnum - from >= Rows)
+	    {
+		lazy->lr_ptr = ptr;
+		break;
+	    }
+	}
+
+	/* Collected lines now point into zeros after a SIGBUS. */
+	if (mmap_bus_error)
+	{
+	    lnum -= app_count;
+	    app_count = 0;
+	}
+	if (append_batch(lnum, app_lines, app_lens, &app_count, newfile)
+								      == FAIL)
+	    error = TRUE;
+	else if (!mmap_bus_error)
+	    mm_good = lnum;
+
+	/*
+	 * If we get EOF in the middle of a line, complete the line ourselves.
+	 * In Dos format ignore a trailing CTRL-Z, unless 'binary' set.
+	 * When the file was truncated while reading it, the rest of the
+	 * mapping contains zeros: drop it.
+	 */
+	if (mmap_bus_error)
+	{
+	    error = TRUE;
+	    if (lazy != NULL)
+		lazy->lr_ptr = NULL;
+	}
+	else if (lazy != NULL && lazy->lr_ptr != NULL)
+	{
+	    lazy->lr_map = mm_ptr;
+	    lazy->lr_size = mm_size;
+	    lazy->lr_fileformat = fileformat;
+	}
+	else if (!error && !got_int && ptr < mm_ptr + mm_size
+		&& !(!curbuf->b_p_bin && fileformat == EOL_DOS
+			&& *ptr == Ctrl('Z') && ptr + 1 == mm_ptr + mm_size))
+	{
+	    if (newfile)		    /* remember for when writing */
+		curbuf->b_p_eol = FALSE;
+	    if (mmap_append(lnum, ptr, (long)(mm_ptr + mm_size - ptr),
+					       fileformat, newfile) == FAIL)
+		error = TRUE;
+	    else
+		read_no_eol_lnum = ++lnum;
+	}
+	if (mmap_guard_end())
+	{
+	    /* A SIGBUS may have happened while appending lines, after the
+	     * last check: delete the lines that may contain the zeros. */
+	    error = TRUE;
+	    if (lazy != NULL)
+		lazy->lr_ptr = NULL;
+	    lnum -= app_count;
+	    app_count = 0;
+	    while (lnum > mm_good)
+		ml_delete(lnum--, FALSE);
+	    if (read_no_eol_lnum > lnum)
+		read_no_eol_lnum = 0;
+	}
+    }
+    else
+#endif
     while (!error && !got_int)
     {
 	/*
@@ -597,49 +867,8 @@ retry:
 	     */
 	    if (fileformat == EOL_UNKNOWN)
 	    {
-		/* First try finding a NL, for Dos and Unix */
-		if (try_dos || try_unix)
-		{
-		    for (p = ptr; p < ptr + size; ++p)
-		    {
-			if (*p == NL)
-			{
-			    if (!try_unix
-				    || (try_dos && p > ptr && p[-1] == CR))
-				fileformat = EOL_DOS;
-			    else
-				fileformat = EOL_UNIX;
-			    break;
-			}
-		    }
-
-		    /* Don't give in to EOL_UNIX if EOL_MAC is more likely */
-		    if (fileformat == EOL_UNIX && try_mac)
-		    {
-			for (; p >= ptr && *p != CR; p--)
-			    ;
-			if (p >= ptr)
-			{
-			    for (p = ptr; p < ptr + size; ++p)
-			    {
-				if (*p == NL)
-				    try_unix++;
-				else if (*p == CR)
-				    try_mac++;
-			    }
-			    if (try_mac > try_unix)
-				fileformat = EOL_MAC;
-			}
-		    }
-		}
-
-		/* No NL found: may use Mac format */
-		if (fileformat == EOL_UNKNOWN && try_mac)
-		    fileformat = EOL_MAC;
-
-		/* Still nothing found?  Use first format in 'ffs' */
-		if (fileformat == EOL_UNKNOWN)
-		    fileformat = default_fileformat();
+		fileformat = guess_fileformat(ptr, size,
+						  try_dos, try_unix, try_mac);
 
 		/* if editing a new file: may set p_tx and p_ff */
 		if (newfile)
@@ -700,12 +929,16 @@ retry:
 #endif
 			*ptr = NUL;	    /* end of line */
 			len = ptr - line_start + 1;
-			if (ml_append(lnum, line_start, len, newfile) == FAIL)
+			app_lines[app_count] = line_start;
+			app_lens[app_count++] = len;
+			++lnum;
+			if (app_count == APPEND_BATCH
+				&& append_batch(lnum, app_lines, app_lens,
+					       &app_count, newfile) == FAIL)
 			{
 			    error = TRUE;
 			    break;
 			}
-			++lnum;
 			if (--read_count == 0)
 			{
 			    error = TRUE;	    /* break loop */
@@ -753,6 +986,8 @@ retry:
 					&& !read_stdin
 					&& lseek(fd, (off_t)0L, SEEK_SET) == 0)
 				{
+				    lnum -= app_count;
+				    app_count = 0;
 				    while (lnum > from)
 					ml_delete(lnum--, FALSE);
 				    fileformat = EOL_UNIX;
@@ -764,12 +999,16 @@ retry:
 				    ff_error = EOL_DOS;
 			    }
 			}
-			if (ml_append(lnum, line_start, len, newfile) == FAIL)
+			app_lines[app_count] = line_start;
+			app_lens[app_count++] = len;
+			++lnum;
+			if (app_count == APPEND_BATCH
+				&& append_batch(lnum, app_lines, app_lens,
+					       &app_count, newfile) == FAIL)
 			{
 			    error = TRUE;
 			    break;
 			}
-			++lnum;
 			if (--read_count == 0)
 			{
 			    error = TRUE;	    /* break loop */
@@ -783,6 +1022,10 @@ retry:
 		}
 	    }
 	}
+	/* append the lines before the next read() overwrites them */
+	if (append_batch(lnum, app_lines, app_lens, &app_count, newfile)
+								      == FAIL)
+	    error = TRUE;
 	linerest = ptr - line_start;
 	ui_breakcheck();
     }
@@ -823,6 +1066,15 @@ retry:
 
     close(fd);			    /* errors are ignored */
     vim_free(buffer);
+#ifdef USE_MMAP_READ
+    if (lazy != NULL && lazy->lr_ptr == NULL)
+    {
+	vim_free(lazy);		    /* the whole file was read */
+	lazy = NULL;
+    }
+    if (mm_ptr != NULL && lazy == NULL)
+	munmap((void *)mm_ptr, (size_t)mm_size);
+#endif
 
     --no_wait_return;		    /* may wait for return now */
 
@@ -838,6 +1090,16 @@ retry:
 	    --linecnt;
 	}
 	linecnt = curbuf->b_ml.ml_line_count - linecnt;
+#ifdef USE_MMAP_READ
+	if (lazy != NULL)
+	{
+	    /* Guess the number of lines not read yet for the message, the
+	     * text is appended by readfile_lazy() from now on. */
+	    linecnt += lazy_line_estimate(lazy, (long)linecnt);
+	    lines_estimated = TRUE;
+	    curbuf->b_ml.ml_lazy = lazy;
+	}
+#endif
 	if (filesize == 0)
 	    linecnt = 0;
 	if (!newfile)
@@ -935,6 +1197,13 @@ retry:
 	    }
 	    if (msg_add_fileformat(fileformat))
 		c = TRUE;
+#ifdef USE_MMAP_READ
+	    if (lines_estimated)
+	    {
+		STRCAT(IObuff, c ? " ~" : "~");
+		c = FALSE;
+	    }
+#endif
 	    msg_add_lines(c, (long)linecnt, filesize);
 
 	    keep_msg = msg_trunc_attr(IObuff, FALSE, 0);
@@ -1009,7 +1278,14 @@ retry:
 	else if (read_stdin)
 	    apply_autocmds(EVENT_STDINREADPOST, NULL, sfname, FALSE, curbuf);
 	else if (newfile)
+	{
+# ifdef USE_MMAP_READ
+	    /* The autocommands may use any line, get them all. */
+	    if (curbuf->b_ml.ml_lazy != NULL && has_bufreadpost())
+		readfile_lazy(curbuf, (linenr_t)MAXLNUM);
+# endif
 	    apply_autocmds(EVENT_BUFREADPOST, NULL, sfname, FALSE, curbuf);
+	}
 	else
 	    apply_autocmds(EVENT_FILEREADPOST, sfname, sfname, FALSE, NULL);
 	if (msg_scrolled == n)
@@ -1022,6 +1298,400 @@ retry:
     return OK;
 }
 
+/*
+ * Guess the end-of-line format from the first "size" bytes read from a file.
+ * The "try_" arguments tell which formats are in 'fileformats'.
+ */
+    static int
+guess_fileformat(ptr, size, try_dos, try_unix, try_mac)
+    char_u	*ptr;
+    long	size;
+    int		try_dos;
+    int		try_unix;
+    int		try_mac;
+{
+    char_u	*p;
+    int		fileformat = EOL_UNKNOWN;
+
+    /* First try finding a NL, for Dos and Unix */
+    if (try_dos || try_unix)
+    {
+	for (p = ptr; p < ptr + size; ++p)
+	{
+	    if (*p == NL)
+	    {
+		if (!try_unix || (try_dos && p > ptr && p[-1] == CR))
+		    fileformat = EOL_DOS;
+		else
+		    fileformat = EOL_UNIX;
+		break;
+	    }
+	}
+
+	/* Don't give in to EOL_UNIX if EOL_MAC is more likely */
+	if (fileformat == EOL_UNIX && try_mac)
+	{
+	    for (; p >= ptr && *p != CR; p--)
+		;
+	    if (p >= ptr)
+	    {
+		for (p = ptr; p < ptr + size; ++p)
+		{
+		    if (*p == NL)
+			try_unix++;
+		    else if (*p == CR)
+			try_mac++;
+		}
+		if (try_mac > try_unix)
+		    fileformat = EOL_MAC;
+	    }
+	}
+    }
+
+    /* No NL found: may use Mac format */
+    if (fileformat == EOL_UNKNOWN && try_mac)
+	fileformat = EOL_MAC;
+
+    /* Still nothing found?  Use first format in 'ffs' */
+    if (fileformat == EOL_UNKNOWN)
+	fileformat = default_fileformat();
+
+    return fileformat;
+}
+
+/*
+ * Append the "*countp" lines that readfile() collected in "lines" and "lens",
+ * "lnum" is the line number for the last one.  Resets "*countp" to zero.
+ * Return FAIL when not all lines could be appended.
+ */
+    static int
+append_batch(lnum, lines, lens, countp, newfile)
+    linenr_t	lnum;
+    char_u	**lines;
+    colnr_t	*lens;
+    int		*countp;
+    int		newfile;
+{
+    long	count = *countp;
+
+    *countp = 0;
+    if (count == 0)
+	return OK;
+    if (ml_append_lines(lnum - count, lines, lens, count, newfile) != count)
+	return FAIL;
+    return OK;
+}
+
+#ifdef USE_MMAP_READ
+/*
+ * Append the "len" bytes at "p" from a mapped file as a line after "lnum".
+ * The mapping is readonly, a line with a NUL (or a NL in Mac format) is
+ * copied to be able to replace it, like readfile() does in its buffer.
+ */
+    static int
+mmap_append(lnum, p, len, fileformat, newfile)
+    linenr_t	lnum;
+    char_u	*p;
+    long	len;
+    int		fileformat;
+    int		newfile;
+{
+    char_u	*copy;
+    char_u	*s;
+    int		retval;
+
+    if (memchr(p, NUL, (size_t)len) == NULL
+	    && (fileformat != EOL_MAC || memchr(p, NL, (size_t)len) == NULL))
+	/* ml_append() adds the NUL */
+	return ml_append(lnum, p, (colnr_t)(len + 1), newfile);
+
+    if ((copy = lalloc((long_u)(len + 1), TRUE)) == NULL)
+	return FAIL;
+    mch_memmove(copy, p, (size_t)len);
+    for (s = copy; s < copy + len; ++s)
+    {
+	if (*s == NUL)
+	    *s = NL;	/* NULs are replaced by newlines! */
+	else if (*s == NL && fileformat == EOL_MAC)
+	    *s = CR;
+    }
+    copy[len] = NUL;
+    retval = ml_append(lnum, copy, (colnr_t)(len + 1), newfile);
+    vim_free(copy);
+    return retval;
+}
+
+/*
+ * Estimate the number of lines in the part of a mapped file that was not
+ * appended yet, from the "linecnt" lines that were appended.  Counting them
+ * would mean going over the whole file, which is what we try to avoid.
+ */
+    static long
+lazy_line_estimate(lazy, linecnt)
+    struct lazyread *lazy;
+    long	    linecnt;
+{
+    long	done = (long)(lazy->lr_ptr - lazy->lr_map);
+    long	todo = lazy->lr_size - done;
+    long	per_line;
+
+    if (linecnt <= 0)
+	return 1L;
+    per_line = done / linecnt;
+    if (per_line <= 0)
+	per_line = 1;
+    return todo / per_line + 1;
+}
+
+/*
+ * Start reading from mapping "ptr" with "size" bytes: catch SIGBUS.
+ */
+    static void
+mmap_guard_start(ptr, size)
+    char_u	*ptr;
+    long	size;
+{
+#ifdef SIGBUS
+    if (mmap_guard_ptr == NULL)	    /* not when retrying in readfile() */
+	mmap_old_bus = signal(SIGBUS, (RETSIGTYPE (*)())mmap_catch_bus);
+#endif
+    mmap_guard_ptr = ptr;
+    mmap_guard_size = size;
+    mmap_bus_error = FALSE;
+}
+
+/*
+ * Done reading from the mapping, restore the SIGBUS handler.
+ * Returns TRUE when a SIGBUS was caught, the file was truncated.
+ */
+    static int
+mmap_guard_end()
+{
+#ifdef SIGBUS
+    signal(SIGBUS, mmap_old_bus);
+#endif
+    mmap_guard_ptr = NULL;
+    return mmap_bus_error;
+}
+
+# ifdef SIGBUS
+/*
+ * SIGBUS handler while reading from a mapping.
+ */
+    static RETSIGTYPE
+mmap_catch_bus SIGDEFARG(sigarg)
+{
+#  ifdef MAP_ANON
+    /* Put zero-filled memory where the file was mapped, the access that
+     * caused the signal is repeated when we return. */
+    if (mmap_guard_ptr != NULL
+	    && mmap(mmap_guard_ptr, (size_t)mmap_guard_size, PROT_READ,
+			    MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, (off_t)0)
+							  != MAP_FAILED)
+    {
+	mmap_bus_error = TRUE;
+	signal(SIGBUS, (RETSIGTYPE (*)())mmap_catch_bus);
+	SIGRETURN;
+    }
+#  endif
+    /* Can't recover: let the previous handler deal with it when the
+     * access is repeated. */
+    signal(SIGBUS, mmap_old_bus);
+    SIGRETURN;
+}
+# endif
+#endif
+
+/*
+ * Append more lines of a file that readfile() did not read completely to
+ * buffer "buf", until it has "lnum" lines.  Use MAXLNUM to read the whole
+ * file.  When "lnum" is zero append up to LAZY_READ_CHUNK bytes, this is used
+ * while waiting for the user to type a character.
+ */
+    void
+readfile_lazy(buf, lnum)
+    BUF		*buf;
+    linenr_t	lnum;
+{
+#ifdef USE_MMAP_READ
+    struct lazyread *lazy = buf->b_ml.ml_lazy;
+    BUF		*save_curbuf;
+    char_u	*ptr;
+    char_u	*eol;
+    char_u	*end;
+    char_u	*chunk_end;
+    long	len;
+    int		ff;
+
+    if (lazy == NULL)
+	return;
+
+    /* Reset ml_lazy, so that ml_append() doesn't call us again. */
+    buf->b_ml.ml_lazy = NULL;
+    save_curbuf = curbuf;
+    curbuf = buf;
+
+    ff = lazy->lr_fileformat;
+    ptr = lazy->lr_ptr;
+    end = lazy->lr_map + lazy->lr_size;
+    chunk_end = (lnum == 0 && end - ptr > LAZY_READ_CHUNK)
+						? ptr + LAZY_READ_CHUNK : end;
+    mmap_guard_start(lazy->lr_map, lazy->lr_size);
+    while (ptr < chunk_end && (lnum == 0 || buf->b_ml.ml_line_count < lnum))
+    {
+	eol = (char_u *)memchr(ptr, ff == EOL_MAC ? CR : NL,
+							  (size_t)(end - ptr));
+	if (mmap_bus_error)
+	    break;
+	if (eol != NULL)
+	{
+	    len = (long)(eol - ptr);
+	    /* Can't go back to Unix format now, keep a line without a CR. */
+	    if (ff == EOL_DOS && len > 0 && eol[-1] == CR)
+		--len;
+	}
+	else
+	{
+	    /* Last line without an EOL.  In Dos format ignore a trailing
+	     * CTRL-Z, unless 'binary' set. */
+	    if (!buf->b_p_bin && ff == EOL_DOS && *ptr == Ctrl('Z')
+							   && ptr + 1 == end)
+	    {
+		ptr = end;
+		break;
+	    }
+	    buf->b_p_eol = FALSE;	/* remember for when writing */
+	    len = (long)(end - ptr);
+	    eol = end - 1;
+	}
+	if (mmap_append(buf->b_ml.ml_line_count, ptr, len, ff, TRUE) == FAIL)
+	{
+	    /* Out of memory: drop the rest of the file and don't allow
+	     * writing the truncated text. */
+	    buf->b_p_ro = TRUE;
+	    ptr = end;
+	    break;
+	}
+	if (mmap_bus_error)
+	{
+	    /* truncated while copying: the line may contain zeros */
+	    ml_delete(buf->b_ml.ml_line_count, FALSE);
+	    break;
+	}
+	ptr = eol + 1;
+    }
+    if (mmap_guard_end())
+    {
+	/* The file was truncated by someone else: the rest of the text is
+	 * lost, don't allow writing what is left. */
+	buf->b_p_ro = TRUE;
+	ptr = end;
+	EMSG2("File \"%s\" was truncated while reading it", buf->b_fname);
+    }
+    curbuf = save_curbuf;
+
+    if (ptr < end)
+    {
+	lazy->lr_ptr = ptr;
+	buf->b_ml.ml_lazy = lazy;
+    }
+    else
+    {
+	munmap((void *)lazy->lr_map, (size_t)lazy->lr_size);
+	vim_free(lazy);
+    }
+    redraw_buf_later(buf, NOT_VALID);
+#endif
+}
+
+/*
+ * Called when the buffer "buf" is unloaded: forget about the lines that were
+ * not read yet.
+ */
+    void
+readfile_lazy_free(buf)
+    BUF		*buf;
+{
+#ifdef USE_MMAP_READ
+    struct lazyread *lazy = buf->b_ml.ml_lazy;
+
+    if (lazy != NULL)
+    {
+	munmap((void *)lazy->lr_map, (size_t)lazy->lr_size);
+	vim_free(lazy);
+	buf->b_ml.ml_lazy = NULL;
+    }
+#endif
+}
+
+/*
+ * Return TRUE when the last "count" lines of the file for buffer "buf" were
+ * not read yet and may contain a modeline.  Only looks at the end of the
+ * mapped file, the rest doesn't need to be read for this.
+ */
+    int
+readfile_lazy_modeline(buf, count)
+    BUF		*buf;
+    int		count;
+{
+#ifdef USE_MMAP_READ
+    struct lazyread *lazy = buf->b_ml.ml_lazy;
+    char_u	*start;
+    char_u	*end;
+    char_u	*p;
+    int		c;
+    int		found = FALSE;
+
+    if (lazy == NULL || count <= 0)
+	return FALSE;
+    c = (lazy->lr_fileformat == EOL_MAC ? CR : NL);
+    start = lazy->lr_ptr;
+    end = lazy->lr_map + lazy->lr_size;
+    mmap_guard_start(lazy->lr_map, lazy->lr_size);
+
+    /* find the start of the last "count" lines */
+    p = end;
+    if (p[-1] == c)
+	--p;
+    while (p > start && !(p[-1] == c && --count == 0))
+	--p;
+
+    if (p == start)
+	found = TRUE;	/* lines in the buffer are included, read it all */
+    else
+	for ( ; p + 3 <= end; ++p)
+	    if ((p[0] == 'v' && p[1] == 'i' && (p[2] == ':'
+			       || (p[2] == 'm' && p + 3 < end && p[3] == ':')))
+		    || (p[0] == 'e' && p[1] == 'x' && p[2] == ':'))
+	    {
+		found = TRUE;
+		break;
+	    }
+
+    /* When truncated let readfile_lazy() give the message. */
+    if (mmap_guard_end())
+	found = TRUE;
+    return found;
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * Read more lines of lazily read files until a character is typed.
+ */
+    void
+readfile_idle()
+{
+#ifdef USE_MMAP_READ
+    BUF		*buf;
+
+    for (buf = firstbuf; buf != NULL; buf = buf->b_next)
+	while (buf->b_ml.ml_lazy != NULL && !ui_char_avail())
+	    readfile_lazy(buf, (linenr_t)0);
+#endif
+}
+
 #ifdef VIMINFO
     static void
 check_marks_read()
@@ -1122,10 +1792,9 @@ buf_write(buf, fname, sfname, start, end, append, forceit,
 #ifdef VMS
     char_u	    *cp, nfname[MAXPATHL];
 #endif
-					    /* writing everything */
-    int		    whole = (start == 1 && end == buf->b_ml.ml_line_count);
+    int		    whole;		    /* writing everything */
 #ifdef AUTOCMD
-    linenr_t	    old_line_count = buf->b_ml.ml_line_count;
+    linenr_t	    old_line_count;
 #endif
     int		    attr;
     int		    fileformat;
@@ -1136,6 +1805,25 @@ buf_write(buf, fname, sfname, start, end, append, forceit,
     if (fname == NULL || *fname == NUL)	    /* safety check */
 	return FAIL;
 
+    /*
+     * When the file was not read completely, get the rest of the lines now.
+     * Every caller that writes up to the last line means the whole file.
+     */
+    if (buf->b_ml.ml_lazy != NULL)
+    {
+	if (end == buf->b_ml.ml_line_count)
+	{
+	    readfile_lazy(buf, (linenr_t)MAXLNUM);
+	    end = buf->b_ml.ml_line_count;
+	}
+	else
+	    readfile_lazy(buf, end);
+    }
+    whole = (start == 1 && end == buf->b_ml.ml_line_count);
+#ifdef AUTOCMD
+    old_line_count = buf->b_ml.ml_line_count;
+#endif
+
     /*
      * If there is no file name yet, use the one for the written file.
      * BF_NOTEDITED is set to reflect this (in case the write fails).
@@ -4150,6 +4838,12 @@ has_cursorhold()
 {
     return (first_autopat[(int)EVENT_CURSORHOLD] != NULL);
 }
+
+    int
+has_bufreadpost()
+{
+    return (first_autopat[(int)EVENT_BUFREADPOST] != NULL);
+}
 #endif
 
     static int
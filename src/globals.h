@@ -308,6 +308,8 @@ EXTERN int	starting INIT(= NO_SCREEN);
 				 * set to 0 when starting up finished */
 EXTERN int	exiting INIT(= FALSE);
 				/* set to TRUE when abandoning Vim */
+EXTERN int	in_deathtrap INIT(= FALSE);
+				/* set to TRUE while handling a deadly signal */
 EXTERN int	full_screen INIT(= FALSE);
 				/* set to TRUE when doing full-screen output
 				 * otherwise only writing some messages */
@@ -2379,20 +2379,18 @@ SetBufferLineList(buf_T *buf, int lo, int hi, PyObject *list, int *len_change)
 	 * must free the strings as we finish with them (we can't pass the
 	 * responsibility to vim in this case).
 	 */
-	if (!PyErr_Occurred())
+	if (!PyErr_Occurred() && i < new_len)
 	{
-	    while (i < new_len)
-	    {
-		if (ml_append((linenr_T)(lo + i - 1),
-					(char_u *)array[i], 0, FALSE) == FAIL)
-		{
-		    PyErr_SetVim(_("cannot insert line"));
-		    break;
-		}
-		vim_free(array[i]);
-		++i;
-		++extra;
-	    }
+	    int	    done;
+
+	    done = (int)ml_append_lines((linenr_T)(lo + i - 1),
+			    (char_u **)array + i, NULL, (long)(new_len - i),
+									FALSE);
+	    if (done < new_len - i)
+		PyErr_SetVim(_("cannot insert line"));
+	    extra += done;
+	    while (done-- > 0)
+		vim_free(array[i++]);
 	}
 
 	/* Free any left-over old_len, as a result of an error */
@@ -2518,25 +2516,18 @@ InsertBufferLines(buf_T *buf, int n, PyObject *lines, int *len_change)
 	    PyErr_SetVim(_("cannot save undo information"));
 	else
 	{
-	    for (i = 0; i < size; ++i)
-	    {
-		if (ml_append((linenr_T)(n + i),
-					(char_u *)array[i], 0, FALSE) == FAIL)
-		{
-		    PyErr_SetVim(_("cannot insert line"));
-
-		    /* Free the rest of the lines */
-		    while (i < size)
-			vim_free(array[i++]);
-
-		    break;
-		}
-		vim_free(array[i]);
-	    }
+	    i = (int)ml_append_lines((linenr_T)n, (char_u **)array, NULL,
+							   (long)size, FALSE);
+	    if (i < size)
+		PyErr_SetVim(_("cannot insert line"));
 	    if (i > 0)
 		appended_lines_mark((linenr_T)n, (long)i);
 	}
 
+	/* Free the lines, ml_append_lines() made copies. */
+	for (i = 0; i < size; ++i)
+	    vim_free(array[i]);
+
 	/* Free the array of lines. All of its contents have now
 	 * been freed.
 	 */
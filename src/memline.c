@@ -58,6 +58,11 @@
 # include <proto/dos.h>	    /* for Open() and Close() */
 #endif
 
+#if defined(UNIX) && defined(HAVE_PTHREAD_H) && defined(HAVE_FSYNC)
+# define ML_SYNC_THREAD
+# include <pthread.h>
+#endif
+
 typedef struct block0		ZERO_BL;    /* contents of the first block */
 typedef struct pointer_block	PTR_BL;	    /* contents of a pointer block */
 typedef struct data_block	DATA_BL;    /* contents of a data block */
@@ -170,6 +175,13 @@ struct block0
 
 #define STACK_INCR	5	/* nr of entries added to ml_stack at a time */
 
+/*
+ * Number of lookups that had to start at the root of the tree before the leaf
+ * index is built again.  Keeps the index from being rebuilt over and over
+ * while lines are being inserted or deleted.
+ */
+#define ML_LEAF_MISSES	5
+
 /*
  * The line number where the first mark may be is remembered.
  * If it is 0 there are no marks at all.
@@ -178,6 +190,25 @@ struct block0
  */
 static linenr_T	lowest_marked = 0;
 
+#ifdef ML_SYNC_THREAD
+/*
+ * Flushing a swap file to disk with fsync() can take very long, e.g. on NFS.
+ * ml_sync_all() only writes the blocks and leaves the fsync() to a writer
+ * thread.  ml_sync_wait() waits for it before the swap file is closed or
+ * must really be on disk (ml_preserve()).
+ */
+# define ML_SYNC_QUEUE	8	/* max. number of pending fsync() calls */
+# define ML_SYNC_SIGWAIT 2	/* max. seconds to wait from a signal handler */
+
+static pthread_mutex_t	ml_sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	ml_sync_todo = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	ml_sync_done = PTHREAD_COND_INITIALIZER;
+static int	ml_sync_fds[ML_SYNC_QUEUE];	/* waiting for fsync() */
+static int	ml_sync_count = 0;		/* used entries in ml_sync_fds */
+static int	ml_sync_busy = -1;		/* fd in fsync() now or -1 */
+static int	ml_sync_started = FALSE;	/* writer thread is running */
+#endif
+
 /*
  * arguments for ml_find_line()
  */
@@ -192,6 +223,7 @@ static time_t swapfile_info __ARGS((char_u *));
 static int recov_file_names __ARGS((char_u **, char_u *, int prepend_dot));
 static int ml_append_int __ARGS((buf_T *, linenr_T, char_u *, colnr_T, int, int));
 static int ml_delete_int __ARGS((buf_T *, linenr_T, int));
+static long ml_delete_part __ARGS((buf_T *, linenr_T, long, int));
 static char_u *findswapname __ARGS((buf_T *, char_u **, char_u *));
 static void ml_flush_line __ARGS((buf_T *));
 static bhdr_T *ml_new_data __ARGS((memfile_T *, int, int));
@@ -200,6 +232,13 @@ static bhdr_T *ml_find_line __ARGS((buf_T *, linenr_T, int));
 static int ml_add_stack __ARGS((buf_T *));
 static char_u *makeswapname __ARGS((buf_T *, char_u *));
 static void ml_lineadd __ARGS((buf_T *, int));
+static void ml_leaf_free __ARGS((buf_T *buf));
+static int ml_leaf_build __ARGS((buf_T *buf));
+static int ml_leaf_collect __ARGS((buf_T *buf, garray_T *gap, blocknr_T bnum, int depth));
+static int ml_leaf_find __ARGS((buf_T *buf, linenr_T lnum, linenr_T *lowp));
+static bhdr_T *ml_leaf_get __ARGS((buf_T *buf, linenr_T lnum));
+static void ml_leaf_locked __ARGS((buf_T *buf, blocknr_T bnum, int page_count, linenr_T line_count, int action));
+static void ml_leaf_lineadd __ARGS((buf_T *buf, int count));
 static int b0_magic_wrong __ARGS((ZERO_BL *));
 #ifdef CHECK_INODE
 static int fnamecmp_ino __ARGS((char_u *, char_u *, long));
@@ -211,7 +250,20 @@ static char_u *make_percent_swname __ARGS((char_u *dir, char_u *name));
 #endif
 #ifdef FEAT_BYTEOFF
 static void ml_updatechunk __ARGS((buf_T *buf, long line, long len, int updtype));
+static void ml_chunk_free __ARGS((buf_T *buf));
+static int ml_chunk_tree __ARGS((buf_T *buf));
+static void ml_chunk_add __ARGS((buf_T *buf, int ix, int lines, long bytes));
+static void ml_chunk_append __ARGS((buf_T *buf));
+static int ml_chunk_find __ARGS((buf_T *buf, long target, int bytes, int ffdos));
+static linenr_T ml_chunk_sum __ARGS((buf_T *buf, int count, long *bytesp));
 #endif
+#ifdef ML_SYNC_THREAD
+static void *ml_sync_thread __ARGS((void *arg));
+static void ml_sync_queue __ARGS((int fd));
+static void ml_sync_wait __ARGS((int fd));
+#endif
+static void ml_recover_readahead __ARGS((memfile_T *mfp, PTR_BL *pp));
+static void ml_recover_progress __ARGS((long done, long total));
 
 /*
  * open a new memline for 'curbuf'
@@ -235,8 +287,18 @@ ml_open()
     curbuf->b_ml.ml_stack_top = 0;	/* nothing in the stack */
     curbuf->b_ml.ml_locked = NULL;	/* no cached block */
     curbuf->b_ml.ml_line_lnum = 0;	/* no cached line */
+    curbuf->b_ml.ml_leaf = NULL;	/* no leaf index yet */
+    curbuf->b_ml.ml_leaf_tree = NULL;
+    curbuf->b_ml.ml_leaf_count = 0;
+    curbuf->b_ml.ml_leaf_misses = 0;
+    curbuf->b_ml.ml_locked_leaf = -1;
+    curbuf->b_ml.ml_lazy = NULL;	/* nothing to read later */
 #ifdef FEAT_BYTEOFF
     curbuf->b_ml.ml_chunksize = NULL;
+    curbuf->b_ml.ml_chunklines = NULL;
+    curbuf->b_ml.ml_chunkbytes = NULL;
+    curbuf->b_ml.ml_chunktree_valid = FALSE;
+    curbuf->b_ml.ml_chunktree_size = 0;
 #endif
 
 /*
@@ -414,6 +476,9 @@ ml_setname(buf)
 	/* need to close the swap file before renaming */
 	if (mfp->mf_fd >= 0)
 	{
+#ifdef ML_SYNC_THREAD
+	    ml_sync_wait(mfp->mf_fd);
+#endif
 	    close(mfp->mf_fd);
 	    mfp->mf_fd = -1;
 	}
@@ -550,13 +615,19 @@ ml_close(buf, del_file)
 {
     if (buf->b_ml.ml_mfp == NULL)		/* not open */
 	return;
+#ifdef ML_SYNC_THREAD
+    ml_sync_wait(buf->b_ml.ml_mfp->mf_fd);	/* pending fsync() */
+#endif
     mf_close(buf->b_ml.ml_mfp, del_file);	/* close the .swp file */
     if (buf->b_ml.ml_line_lnum != 0 && (buf->b_ml.ml_flags & ML_LINE_DIRTY))
 	vim_free(buf->b_ml.ml_line_ptr);
     vim_free(buf->b_ml.ml_stack);
+    ml_leaf_free(buf);
+    readfile_lazy_free(buf);
 #ifdef FEAT_BYTEOFF
     vim_free(buf->b_ml.ml_chunksize);
     buf->b_ml.ml_chunksize = NULL;
+    ml_chunk_free(buf);
 #endif
     buf->b_ml.ml_mfp = NULL;
 
@@ -724,6 +795,10 @@ ml_recover()
     int		serious_error = TRUE;
     long	mtime;
     int		attr;
+    char_u	**lines = NULL;	/* lines of a data block */
+    int		lines_size = 0;	/* number of entries in "lines" */
+    long	blocks_done = 0;
+    int		did_progress = FALSE;
 
     recoverymode = TRUE;
     called_from_main = (curbuf->b_ml.ml_mfp == NULL);
@@ -998,6 +1073,10 @@ ml_recover()
 		    }
 		}
 
+		/* start reading the blocks below this one */
+		if (idx == 0)
+		    ml_recover_readahead(mfp, pp);
+
 		if (pp->pb_count == 0)
 		{
 		    ml_append(lnum++, (char_u *)_("???EMPTY BLOCK"),
@@ -1101,6 +1180,15 @@ ml_recover()
 			has_error = TRUE;
 		    }
 
+		    if ((int)dp->db_line_count > lines_size)
+		    {
+			vim_free(lines);
+			lines_size = dp->db_line_count;
+			lines = (char_u **)alloc(
+				       (unsigned)(lines_size * sizeof(char_u *)));
+			if (lines == NULL)
+			    lines_size = 0;
+		    }
 		    for (i = 0; i < dp->db_line_count; ++i)
 		    {
 			txt_start = (dp->db_index[i] & DB_INDEX_MASK);
@@ -1112,7 +1200,20 @@ ml_recover()
 			}
 			else
 			    p = (char_u *)dp + txt_start;
-			ml_append(lnum++, p, (colnr_T)0, TRUE);
+			if (lines != NULL)
+			    lines[i] = p;
+			else		/* out of memory: one line at a time */
+			    ml_append(lnum++, p, (colnr_T)0, TRUE);
+		    }
+		    if (lines != NULL)
+			lnum += ml_append_lines(lnum, lines, NULL,
+					       (long)dp->db_line_count, TRUE);
+
+		    if (mfp->mf_blocknr_max > 0 && (++blocks_done & 0xff) == 0)
+		    {
+			ml_recover_progress(blocks_done,
+						    (long)mfp->mf_blocknr_max);
+			did_progress = TRUE;
 		    }
 		    if (has_error)
 			ml_append(lnum++, (char_u *)_("???END"), (colnr_T)0, TRUE);
@@ -1132,6 +1233,16 @@ ml_recover()
 	page_count = 1;
     }
 
+    if (did_progress)
+    {
+	/* clear the progress message */
+	i = msg_scroll;
+	msg_scroll = FALSE;
+	msg_start();
+	msg_clr_eos();
+	msg_scroll = i;
+    }
+
     /*
      * The dummy line from the empty buffer will now be after the last line in
      * the buffer. Delete it.
@@ -1169,6 +1280,7 @@ theend:
 	    mf_put(mfp, hp, FALSE, FALSE);
 	mf_close(mfp, FALSE);	    /* will also vim_free(mfp->mf_fname) */
     }
+    vim_free(lines);
     vim_free(buf);
     if (serious_error && called_from_main)
 	ml_close(curbuf, TRUE);
@@ -1182,6 +1294,54 @@ theend:
     return;
 }
 
+/*
+ * Tell the system that the blocks that pointer block "pp" refers to are
+ * going to be read, so that it can read them in parallel while ml_recover()
+ * is busy with the blocks before them.
+ */
+    static void
+ml_recover_readahead(mfp, pp)
+    memfile_T	*mfp;
+    PTR_BL	*pp;
+{
+#if defined(HAVE_FCNTL_H) && defined(POSIX_FADV_WILLNEED)
+    int		i;
+    PTR_EN	*pe;
+
+    for (i = 0; i < (int)pp->pb_count; ++i)
+    {
+	pe = &pp->pb_pointer[i];
+	if (pe->pe_bnum > 0 && pe->pe_bnum < mfp->mf_blocknr_max)
+	    (void)posix_fadvise(mfp->mf_fd,
+				(off_t)pe->pe_bnum * mfp->mf_page_size,
+				(off_t)pe->pe_page_count * mfp->mf_page_size,
+				POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+/*
+ * Show how far ml_recover() got, "done" data blocks out of about "total"
+ * blocks.  Overwrites the previous progress message.
+ */
+    static void
+ml_recover_progress(done, total)
+    long	done;
+    long	total;
+{
+    int		save_msg_scroll = msg_scroll;
+
+    if (done > total)
+	done = total;
+    sprintf((char *)IObuff, _("Recovering... %ld%%"), done * 100L / total);
+    msg_scroll = FALSE;
+    msg_start();
+    msg_outtrans(IObuff);
+    msg_clr_eos();
+    out_flush();
+    msg_scroll = save_msg_scroll;
+}
+
 /*
  * Find the names of swap files in current directory and the directory given
  * with the 'directory' option.
@@ -1703,6 +1863,8 @@ ml_sync_all(check_file, check_char)
 {
     buf_T		*buf;
     struct stat		st;
+    int			flags;
+    int			async;
 
     for (buf = firstbuf; buf != NULL; buf = buf->b_next)
     {
@@ -1730,8 +1892,24 @@ ml_sync_all(check_file, check_char)
 	}
 	if (buf->b_ml.ml_mfp->mf_dirty)
 	{
-	    (void)mf_sync(buf->b_ml.ml_mfp, (check_char ? MFS_STOP : 0)
-					| (bufIsChanged(buf) ? MFS_FLUSH : 0));
+	    flags = (check_char ? MFS_STOP : 0);
+	    async = FALSE;
+	    if (bufIsChanged(buf))
+	    {
+#ifdef ML_SYNC_THREAD
+		/* Write the blocks now, let the writer thread wait for the
+		 * disk. */
+		if (STRCMP(p_sws, "fsync") == 0 && !in_deathtrap)
+		    async = TRUE;
+		else
+#endif
+		    flags |= MFS_FLUSH;
+	    }
+	    (void)mf_sync(buf->b_ml.ml_mfp, flags);
+#ifdef ML_SYNC_THREAD
+	    if (async && buf->b_ml.ml_mfp->mf_fd >= 0)
+		ml_sync_queue(buf->b_ml.ml_mfp->mf_fd);
+#endif
 	    if (check_char && ui_char_avail())	/* character available now */
 		break;
 	}
@@ -1770,6 +1948,9 @@ ml_preserve(buf, message)
      * before. */
     got_int = FALSE;
 
+#ifdef ML_SYNC_THREAD
+    ml_sync_wait(mfp->mf_fd);			    /* finish pending fsync() */
+#endif
     ml_flush_line(buf);				    /* flush buffered line */
     (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH); /* flush locked block */
     status = mf_sync(mfp, MFS_ALL | MFS_FLUSH);
@@ -1821,6 +2002,124 @@ theend:
     }
 }
 
+#ifdef ML_SYNC_THREAD
+/*
+ * The swap file writer thread: fsync() the file descriptors in ml_sync_fds.
+ */
+    static void *
+ml_sync_thread(arg)
+    void	*arg;
+{
+    int		fd;
+
+    pthread_mutex_lock(&ml_sync_mutex);
+    for (;;)
+    {
+	while (ml_sync_count == 0)
+	    pthread_cond_wait(&ml_sync_todo, &ml_sync_mutex);
+	fd = ml_sync_fds[0];
+	--ml_sync_count;
+	mch_memmove(ml_sync_fds, ml_sync_fds + 1,
+					  (size_t)ml_sync_count * sizeof(int));
+	ml_sync_busy = fd;
+	pthread_mutex_unlock(&ml_sync_mutex);
+
+	(void)fsync(fd);
+
+	pthread_mutex_lock(&ml_sync_mutex);
+	ml_sync_busy = -1;
+	pthread_cond_broadcast(&ml_sync_done);
+    }
+    /*NOTREACHED*/
+    return arg;
+}
+
+/*
+ * Let the writer thread fsync() swap file "fd".
+ * When the thread can't be started or too many are waiting do it now.
+ */
+    static void
+ml_sync_queue(fd)
+    int		fd;
+{
+    pthread_t	thread;
+    sigset_t	all, save;
+    int		i;
+
+    pthread_mutex_lock(&ml_sync_mutex);
+    if (!ml_sync_started)
+    {
+	/* Signals must be handled by the main thread, block them all in the
+	 * writer thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &save);
+	if (pthread_create(&thread, NULL, ml_sync_thread, NULL) == 0)
+	{
+	    pthread_detach(thread);
+	    ml_sync_started = TRUE;
+	}
+	pthread_sigmask(SIG_SETMASK, &save, NULL);
+    }
+
+    /* An fsync() that didn't start yet also covers what was written now. */
+    for (i = 0; i < ml_sync_count; ++i)
+	if (ml_sync_fds[i] == fd)
+	    break;
+    if (i < ml_sync_count)
+	fd = -1;
+    else if (ml_sync_started && ml_sync_count < ML_SYNC_QUEUE)
+    {
+	ml_sync_fds[ml_sync_count++] = fd;
+	pthread_cond_signal(&ml_sync_todo);
+	fd = -1;
+    }
+    pthread_mutex_unlock(&ml_sync_mutex);
+
+    if (fd >= 0)
+	(void)fsync(fd);
+}
+
+/*
+ * Wait for the writer thread to finish fsync() on swap file "fd".
+ * When handling a deadly signal the main thread may have been interrupted
+ * while holding ml_sync_mutex: don't block on it and give up waiting after
+ * ML_SYNC_SIGWAIT seconds.  The caller does its own fsync() anyway.
+ */
+    static void
+ml_sync_wait(fd)
+    int		fd;
+{
+    int		i;
+    struct timespec deadline;
+
+    if (fd < 0 || !ml_sync_started)
+	return;
+    if (in_deathtrap)
+    {
+	if (pthread_mutex_trylock(&ml_sync_mutex) != 0)
+	    return;
+	deadline.tv_sec = time(NULL) + ML_SYNC_SIGWAIT;
+	deadline.tv_nsec = 0;
+    }
+    else
+	pthread_mutex_lock(&ml_sync_mutex);
+    for (;;)
+    {
+	for (i = 0; i < ml_sync_count; ++i)
+	    if (ml_sync_fds[i] == fd)
+		break;
+	if (i == ml_sync_count && ml_sync_busy != fd)
+	    break;
+	if (!in_deathtrap)
+	    pthread_cond_wait(&ml_sync_done, &ml_sync_mutex);
+	else if (pthread_cond_timedwait(&ml_sync_done, &ml_sync_mutex,
+							       &deadline) != 0)
+	    break;
+    }
+    pthread_mutex_unlock(&ml_sync_mutex);
+}
+#endif
+
 /*
  * NOTE: The pointer returned by the ml_get_*() functions only remains valid
  * until the next call!
@@ -1886,6 +2185,10 @@ ml_get_buf(buf, lnum, will_change)
     DATA_BL *dp;
     char_u  *ptr;
 
+    /* The line may be in the part of the file that wasn't read yet. */
+    if (lnum > buf->b_ml.ml_line_count && buf->b_ml.ml_lazy != NULL)
+	readfile_lazy(buf, lnum);
+
     if (lnum > buf->b_ml.ml_line_count)	/* invalid line number */
     {
 	EMSGN(_("E315: ml_get: invalid lnum: %ld"), lnum);
@@ -1945,6 +2248,9 @@ ml_line_alloced()
  * Append a line after lnum (may be 0 to insert a line in front of the file).
  * "line" does not need to be allocated, but can't be another line in a
  * buffer, unlocking may make it invalid.
+ * When "len" is given the text does not need to end in a NUL, only len - 1
+ * bytes are copied and a NUL is added.  This is used for reading lines from a
+ * mapped file.
  *
  *   newfile: TRUE when starting to edit a new file, meaning that pe_old_lnum
  *		will be set for recovery
@@ -1964,11 +2270,117 @@ ml_append(lnum, line, len, newfile)
     if (curbuf->b_ml.ml_mfp == NULL && open_buffer(FALSE, NULL) == FAIL)
 	return FAIL;
 
+    /* Appending after the last line: the rest of a file that was read
+     * lazily must go below it. */
+    if (lnum >= curbuf->b_ml.ml_line_count && curbuf->b_ml.ml_lazy != NULL)
+	readfile_lazy(curbuf, MAXLNUM);
+
     if (curbuf->b_ml.ml_line_lnum != 0)
 	ml_flush_line(curbuf);
     return ml_append_int(curbuf, lnum, line, len, newfile, FALSE);
 }
 
+/*
+ * Append "count" lines after "lnum" in the current buffer.
+ * "lines[i]" is the text of a line and "lens[i]" its length, like "line" and
+ * "len" for ml_append().  "lens" can be NULL when all lines end in a NUL.
+ * A line that goes after the last line of the locked data block and fits in
+ * it is copied there directly, thus lines fill the data blocks one after the
+ * other without finding the block for each line.  Other lines are appended
+ * with ml_append_int().
+ *
+ * Check: The caller of this function should probably also call
+ * appended_lines().
+ *
+ * return the number of lines appended, less than "count" for failure
+ */
+    long
+ml_append_lines(lnum, lines, lens, count, newfile)
+    linenr_T	lnum;		/* append after this line (can be 0) */
+    char_u	**lines;	/* text of the new lines */
+    colnr_T	*lens;		/* lengths including NUL, NULL or 0 */
+    long	count;		/* number of lines */
+    int		newfile;	/* flag, see ml_append() */
+{
+    buf_T	*buf = curbuf;
+    long	done;
+    colnr_T	len;
+    int		space_needed;
+    int		idx;
+    DATA_BL	*dp;
+
+    /* When starting up, we might still need to create the memfile */
+    if (buf->b_ml.ml_mfp == NULL && open_buffer(FALSE, NULL) == FAIL)
+	return 0L;
+
+    if (lnum >= buf->b_ml.ml_line_count && buf->b_ml.ml_lazy != NULL)
+	readfile_lazy(buf, MAXLNUM);
+
+    if (buf->b_ml.ml_line_lnum != 0)
+	ml_flush_line(buf);
+
+    for (done = 0; done < count; ++done, ++lnum)
+    {
+	if (lens == NULL || lens[done] == 0)
+	    len = (colnr_T)STRLEN(lines[done]) + 1;
+	else
+	    len = lens[done];
+	space_needed = len + INDEX_SIZE;
+
+	if (lnum == 0
+		|| buf->b_ml.ml_locked == NULL
+		|| (buf->b_ml.ml_flags & ML_LOCKED_INDEX)
+		|| lnum != buf->b_ml.ml_locked_high
+		|| (int)((DATA_BL *)buf->b_ml.ml_locked->bh_data)->db_free
+								< space_needed)
+	{
+	    if (ml_append_int(buf, lnum, lines[done], len, newfile, FALSE)
+								      == FAIL)
+		break;
+	    continue;
+	}
+
+	/*
+	 * Add the line at the end of the locked block, like ml_append_int()
+	 * does after ml_find_line() found the block with ML_INSERT.
+	 */
+	if (lowest_marked && lowest_marked > lnum)
+	    lowest_marked = lnum + 1;
+	dp = (DATA_BL *)(buf->b_ml.ml_locked->bh_data);
+	idx = lnum - buf->b_ml.ml_locked_low + 1;
+	dp->db_txt_start -= len;
+	dp->db_free -= space_needed;
+	++(dp->db_line_count);
+	dp->db_index[idx] = dp->db_txt_start;
+	mch_memmove((char *)dp + dp->db_txt_start, lines[done],
+							  (size_t)(len - 1));
+	*((char_u *)dp + dp->db_txt_start + len - 1) = NUL;
+
+	++(buf->b_ml.ml_locked_lineadd);
+	++(buf->b_ml.ml_locked_high);
+	ml_leaf_lineadd(buf, 1);
+	++buf->b_ml.ml_line_count;
+	buf->b_ml.ml_flags = (buf->b_ml.ml_flags | ML_LOCKED_DIRTY) & ~ML_EMPTY;
+	if (!newfile)
+	    buf->b_ml.ml_flags |= ML_LOCKED_POS;
+
+#ifdef FEAT_BYTEOFF
+	ml_updatechunk(buf, lnum + 1, (long)len, ML_CHNK_ADDLINE);
+#endif
+#ifdef FEAT_NETBEANS_INTG
+	if (usingNetbeans)
+	{
+	    if (len > 1)
+		netbeans_inserted(buf, lnum + 1, (colnr_T)0, 0, lines[done],
+								     len - 1);
+	    netbeans_inserted(buf, lnum + 1, (colnr_T)(len - 1), 0,
+							   (char_u *)"\n", 1);
+	}
+#endif
+    }
+    return done;
+}
+
     static int
 ml_append_int(buf, lnum, line, len, newfile, mark)
     buf_T	*buf;
@@ -2043,6 +2455,7 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	 */
 	--(buf->b_ml.ml_locked_lineadd);
 	--(buf->b_ml.ml_locked_high);
+	ml_leaf_lineadd(buf, -1);
 	if ((hp = ml_find_line(buf, lnum + 1, ML_INSERT)) == NULL)
 	    return FAIL;
 
@@ -2092,7 +2505,9 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	/*
 	 * copy the text into the block
 	 */
-	mch_memmove((char *)dp + dp->db_index[db_idx + 1], line, (size_t)len);
+	mch_memmove((char *)dp + dp->db_index[db_idx + 1], line,
+							  (size_t)(len - 1));
+	*((char_u *)dp + dp->db_index[db_idx + 1] + len - 1) = NUL;
 	if (mark)
 	    dp->db_index[db_idx + 1] |= DB_MARKED;
 
@@ -2175,6 +2590,7 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 			/* correct line counts in pointer blocks */
 	    --(buf->b_ml.ml_locked_lineadd);
 	    --(buf->b_ml.ml_locked_high);
+	    ml_leaf_lineadd(buf, -1);
 	    return FAIL;
 	}
 	if (db_idx < 0)		/* left block is new */
@@ -2210,7 +2626,8 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		dp_right->db_index[0] |= DB_MARKED;
 
 	    mch_memmove((char *)dp_right + dp_right->db_txt_start,
-							   line, (size_t)len);
+						     line, (size_t)(len - 1));
+	    *((char_u *)dp_right + dp_right->db_txt_start + len - 1) = NUL;
 	    ++line_count_right;
 	}
 	/*
@@ -2250,7 +2667,8 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	    if (mark)
 		dp_left->db_index[line_count_left] |= DB_MARKED;
 	    mch_memmove((char *)dp_left + dp_left->db_txt_start,
-							   line, (size_t)len);
+						     line, (size_t)(len - 1));
+	    *((char_u *)dp_left + dp_left->db_txt_start + len - 1) = NUL;
 	    ++line_count_left;
 	}
 
@@ -2282,6 +2700,9 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	    buf->b_ml.ml_flags |= ML_LOCKED_POS;
 	mf_put(mfp, hp_new, TRUE, FALSE);
 
+	/* a data block was added, the leaf index must be built again */
+	ml_leaf_free(buf);
+
 	/*
 	 * flush the old data block
 	 * set ml_locked_lineadd to 0, because the updating of the
@@ -2458,9 +2879,9 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 #ifdef FEAT_NETBEANS_INTG
     if (usingNetbeans)
     {
-	if (STRLEN(line) > 0)
-	    netbeans_inserted(buf, lnum+1, (colnr_T)0, 0, line, STRLEN(line));
-	netbeans_inserted(buf, lnum+1, (colnr_T)STRLEN(line), 0,
+	if (len > 1)
+	    netbeans_inserted(buf, lnum+1, (colnr_T)0, 0, line, len - 1);
+	netbeans_inserted(buf, lnum+1, (colnr_T)(len - 1), 0,
 							   (char_u *)"\n", 1);
     }
 #endif
@@ -2528,6 +2949,134 @@ ml_delete(lnum, message)
     return ml_delete_int(curbuf, lnum, message);
 }
 
+/*
+ * delete "count" lines starting at "lnum"
+ *
+ * Removes all the lines of a data block with one move of the text and the
+ * indexes, instead of finding the block and moving the text for every line.
+ *
+ * Check: The caller of this function should probably also call
+ * deleted_lines() after this.
+ *
+ * return FAIL for failure, OK otherwise
+ */
+    int
+ml_delete_range(lnum, count, message)
+    linenr_T	lnum;
+    long	count;
+    int		message;
+{
+    long	done;
+
+    if (lnum < 1 || count < 0 || lnum + count - 1 > curbuf->b_ml.ml_line_count)
+	return FAIL;
+
+    ml_flush_line(curbuf);
+    while (count > 0)
+    {
+	if ((done = ml_delete_part(curbuf, lnum, count, message)) <= 0)
+	    return FAIL;
+	count -= done;
+    }
+    return OK;
+}
+
+/*
+ * Delete up to "count" lines starting at "lnum", as far as they are in the
+ * same data block.  The last line of a block is deleted with ml_delete_int(),
+ * it takes care of freeing the block and of the file becoming empty.
+ * return the number of lines deleted, -1 for failure
+ */
+    static long
+ml_delete_part(buf, lnum, count, message)
+    buf_T	*buf;
+    linenr_T	lnum;
+    long	count;
+    int		message;
+{
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    int		line_count;	/* number of lines in block */
+    int		idx;
+    int		n;
+    int		i;
+    int		text_start;
+    int		text_end;	/* end of text of deleted lines */
+    int		line_start;	/* start of text of deleted lines */
+    long	size;
+
+    if ((hp = ml_find_line(buf, lnum, ML_FIND)) == NULL)
+	return -1L;
+    line_count = buf->b_ml.ml_locked_high - buf->b_ml.ml_locked_low + 1;
+    idx = lnum - buf->b_ml.ml_locked_low;
+    if (count < line_count - idx)
+	n = (int)count;
+    else
+	n = line_count - idx;
+    if (n == line_count)
+	--n;		/* leave one line for ml_delete_int() */
+    if (n <= 1)
+	return ml_delete_int(buf, lnum, message) == FAIL ? -1L : 1L;
+
+    /*
+     * Find the block again with ML_DELETE, the pointer blocks are adjusted
+     * for one line.  Adjust for the other lines like the locked block
+     * shortcut in ml_find_line() does.
+     */
+    if ((hp = ml_find_line(buf, lnum, ML_DELETE)) == NULL)
+	return -1L;
+    buf->b_ml.ml_locked_lineadd -= n - 1;
+    buf->b_ml.ml_locked_high -= n - 1;
+    ml_leaf_lineadd(buf, -(n - 1));
+    buf->b_ml.ml_line_count -= n;
+
+    if (lowest_marked && lowest_marked > lnum)
+	lowest_marked = lowest_marked > lnum + n ? lowest_marked - n : lnum;
+
+    dp = (DATA_BL *)(hp->bh_data);
+    text_end = idx == 0 ? (int)dp->db_txt_end
+			     : (int)((dp->db_index[idx - 1]) & DB_INDEX_MASK);
+    line_start = ((dp->db_index[idx + n - 1]) & DB_INDEX_MASK);
+    size = text_end - line_start;
+
+#if defined(FEAT_BYTEOFF) || defined(FEAT_NETBEANS_INTG)
+    for (i = idx; i < idx + n; ++i)
+    {
+	long	line_size;
+
+	line_size = (i == 0 ? (int)dp->db_txt_end
+			      : (int)((dp->db_index[i - 1]) & DB_INDEX_MASK))
+				     - (int)((dp->db_index[i]) & DB_INDEX_MASK);
+# ifdef FEAT_NETBEANS_INTG
+	if (usingNetbeans)
+	    netbeans_removed(buf, lnum, 0, line_size);
+# endif
+# ifdef FEAT_BYTEOFF
+	ml_updatechunk(buf, lnum, line_size, ML_CHNK_DELLINE);
+# endif
+    }
+#endif
+
+    /*
+     * delete the text by moving the next lines forwards
+     * delete the indexes by moving the next indexes backwards
+     * Adjust the indexes for the text movement.
+     */
+    text_start = dp->db_txt_start;
+    mch_memmove((char *)dp + text_start + size, (char *)dp + text_start,
+					     (size_t)(line_start - text_start));
+    for (i = idx; i < line_count - n; ++i)
+	dp->db_index[i] = dp->db_index[i + n] + size;
+
+    dp->db_free += size + n * INDEX_SIZE;
+    dp->db_txt_start += size;
+    dp->db_line_count -= n;
+
+    /* mark the block dirty and make sure it is in the file (for recovery) */
+    buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    return (long)n;
+}
+
     static int
 ml_delete_int(buf, lnum, message)
     buf_T	*buf;
@@ -2617,6 +3166,7 @@ ml_delete_int(buf, lnum, message)
     {
 	mf_free(mfp, hp);	/* free the data block */
 	buf->b_ml.ml_locked = NULL;
+	ml_leaf_free(buf);	/* leaf index must be built again */
 
 	for (stack_idx = buf->b_ml.ml_stack_top - 1; stack_idx >= 0; --stack_idx)
 	{
@@ -3011,19 +3561,25 @@ ml_find_line(buf, lnum, action)
      */
     if (buf->b_ml.ml_locked)
     {
+	/* When the block was found with the leaf index the stack is not
+	 * valid, need to walk the tree to insert or delete. */
 	if (ML_SIMPLE(action) && buf->b_ml.ml_locked_low <= lnum
-					  && buf->b_ml.ml_locked_high >= lnum)
+					  && buf->b_ml.ml_locked_high >= lnum
+		&& (action == ML_FIND
+			       || !(buf->b_ml.ml_flags & ML_LOCKED_INDEX)))
 	{
 		/* remember to update pointer blocks and stack later */
 	    if (action == ML_INSERT)
 	    {
 		++(buf->b_ml.ml_locked_lineadd);
 		++(buf->b_ml.ml_locked_high);
+		ml_leaf_lineadd(buf, 1);
 	    }
 	    else if (action == ML_DELETE)
 	    {
 		--(buf->b_ml.ml_locked_lineadd);
 		--(buf->b_ml.ml_locked_high);
+		ml_leaf_lineadd(buf, -1);
 	    }
 	    return (buf->b_ml.ml_locked);
 	}
@@ -3050,7 +3606,9 @@ ml_find_line(buf, lnum, action)
 
     if (action == ML_FIND)	/* first try stack entries */
     {
-	for (top = buf->b_ml.ml_stack_top - 1; top >= 0; --top)
+	int	deepest = buf->b_ml.ml_stack_top - 1;
+
+	for (top = deepest; top >= 0; --top)
 	{
 	    ip = &(buf->b_ml.ml_stack[top]);
 	    if (ip->ip_low <= lnum && ip->ip_high >= lnum)
@@ -3064,6 +3622,17 @@ ml_find_line(buf, lnum, action)
 	}
 	if (top < 0)
 	    buf->b_ml.ml_stack_top = 0;		/* not found, start at the root */
+
+	/*
+	 * When the line is not below the last pointer block we would have to
+	 * walk down several levels of the tree.  Use the leaf index to go to
+	 * the data block directly.
+	 */
+	if (top < 0 || top < deepest)
+	{
+	    if ((hp = ml_leaf_get(buf, lnum)) != NULL)
+		return hp;
+	}
     }
     else	/* ML_DELETE or ML_INSERT */
 	buf->b_ml.ml_stack_top = 0;	/* start at the root */
@@ -3091,7 +3660,9 @@ ml_find_line(buf, lnum, action)
 	    buf->b_ml.ml_locked_low = low;
 	    buf->b_ml.ml_locked_high = high;
 	    buf->b_ml.ml_locked_lineadd = 0;
-	    buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+	    buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS
+							  | ML_LOCKED_INDEX);
+	    ml_leaf_locked(buf, bnum, page_count, dp->db_line_count, action);
 	    return hp;
 	}
 
@@ -3166,6 +3737,7 @@ ml_find_line(buf, lnum, action)
 error_block:
     mf_put(mfp, hp, FALSE, FALSE);
 error_noblock:
+    ml_leaf_free(buf);
 /*
  * If action is ML_DELETE or ML_INSERT we have to correct the tree for
  * the incremented/decremented line counts, because there won't be a line
@@ -3251,6 +3823,304 @@ ml_lineadd(buf, count)
     }
 }
 
+/*
+ * Free the leaf index of "buf".  It will be built again when needed.
+ */
+    static void
+ml_leaf_free(buf)
+    buf_T	*buf;
+{
+    vim_free(buf->b_ml.ml_leaf);
+    buf->b_ml.ml_leaf = NULL;
+    vim_free(buf->b_ml.ml_leaf_tree);
+    buf->b_ml.ml_leaf_tree = NULL;
+    buf->b_ml.ml_leaf_count = 0;
+    buf->b_ml.ml_leaf_misses = 0;
+    buf->b_ml.ml_locked_leaf = -1;
+}
+
+/*
+ * Build the leaf index for "buf" by walking all the pointer blocks.
+ * All data blocks are at the same depth, because the tree only gets an extra
+ * level when the root is split.  Thus only the pointer blocks have to be
+ * read, not the data blocks.
+ * Return FAIL when something is wrong, the index is not used then.
+ */
+    static int
+ml_leaf_build(buf)
+    buf_T	*buf;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    blocknr_T	bnum;
+    int		page_count;
+    int		depth;
+    int		n;
+    int		i, j;
+    linenr_T	*tree;
+    garray_T	ga;
+
+    /*
+     * Find the depth of the tree by following the first pointers.  Pointer
+     * blocks always have a positive block number, a negative one must be a
+     * data block.
+     */
+    bnum = 1;
+    page_count = 1;
+    for (depth = -1; bnum > 0; ++depth)
+    {
+	if ((hp = mf_get(mfp, bnum, page_count)) == NULL)
+	    return FAIL;
+	pp = (PTR_BL *)(hp->bh_data);
+	if (pp->pb_id != PTR_ID)
+	{
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    break;
+	}
+	if (pp->pb_count == 0)
+	{
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    return FAIL;
+	}
+	bnum = pp->pb_pointer[0].pe_bnum;
+	page_count = pp->pb_pointer[0].pe_page_count;
+	mf_put(mfp, hp, FALSE, FALSE);
+    }
+    if (depth < 0)
+	return FAIL;
+
+    /* Grow in large steps, a data block usually holds more than 32 lines. */
+    ga_init2(&ga, (int)sizeof(mlleaf_T),
+				    (int)(buf->b_ml.ml_line_count / 32) + 100);
+    if (ml_leaf_collect(buf, &ga, (blocknr_T)1, depth) == FAIL
+	    || (tree = (linenr_T *)alloc((unsigned)(sizeof(linenr_T)
+						 * (ga.ga_len + 1)))) == NULL)
+    {
+	ga_clear(&ga);
+	return FAIL;
+    }
+
+    /* Fill the Fenwick tree in linear time. */
+    n = ga.ga_len;
+    tree[0] = 0;
+    for (i = 1; i <= n; ++i)
+	tree[i] = ((mlleaf_T *)ga.ga_data)[i - 1].ll_line_count;
+    for (i = 1; i <= n; ++i)
+    {
+	j = i + (i & -i);
+	if (j <= n)
+	    tree[j] += tree[i];
+    }
+
+    buf->b_ml.ml_leaf = (mlleaf_T *)ga.ga_data;
+    buf->b_ml.ml_leaf_tree = tree;
+    buf->b_ml.ml_leaf_count = n;
+    buf->b_ml.ml_locked_leaf = -1;
+    return OK;
+}
+
+/*
+ * Add the data blocks below pointer block "bnum" to the leaf index in "gap".
+ * "depth" is the number of pointer block levels below "bnum".
+ */
+    static int
+ml_leaf_collect(buf, gap, bnum, depth)
+    buf_T	*buf;
+    garray_T	*gap;
+    blocknr_T	bnum;
+    int		depth;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    PTR_EN	*pe;
+    mlleaf_T	*lp;
+    int		idx;
+    int		retval = OK;
+
+    if ((hp = mf_get(mfp, bnum, 1)) == NULL)
+	return FAIL;
+    pp = (PTR_BL *)(hp->bh_data);
+    if (pp->pb_id != PTR_ID)
+	retval = FAIL;
+    for (idx = 0; retval == OK && idx < (int)pp->pb_count; ++idx)
+    {
+	pe = &pp->pb_pointer[idx];
+	if (depth > 0)
+	    retval = ml_leaf_collect(buf, gap, pe->pe_bnum, depth - 1);
+	else if (ga_grow(gap, 1) == FAIL)
+	    retval = FAIL;
+	else
+	{
+	    /* A negative block number is not translated here, that must be
+	     * done by ml_find_line() to also update the pointer block. */
+	    lp = (mlleaf_T *)gap->ga_data + gap->ga_len;
+	    lp->ll_bnum = pe->pe_bnum;
+	    lp->ll_page_count = pe->pe_page_count;
+	    lp->ll_line_count = pe->pe_line_count;
+	    ++gap->ga_len;
+	    --gap->ga_room;
+	}
+    }
+    mf_put(mfp, hp, FALSE, FALSE);
+    return retval;
+}
+
+/*
+ * Find the entry in the leaf index for the data block that contains line
+ * "lnum".  When "lowp" is not NULL the first line in that block is stored in
+ * "*lowp".
+ * Return the index in ml_leaf, -1 when not found.
+ */
+    static int
+ml_leaf_find(buf, lnum, lowp)
+    buf_T	*buf;
+    linenr_T	lnum;
+    linenr_T	*lowp;
+{
+    linenr_T	*tree = buf->b_ml.ml_leaf_tree;
+    int		n = buf->b_ml.ml_leaf_count;
+    int		idx = 0;
+    int		step;
+    linenr_T	rest = lnum;
+
+    if (tree == NULL || lnum < 1)
+	return -1;
+
+    /* Descend the Fenwick tree, skipping blocks that end before "lnum". */
+    for (step = 1; step * 2 <= n; step *= 2)
+	;
+    for ( ; step > 0; step >>= 1)
+	if (idx + step <= n && tree[idx + step] < rest)
+	{
+	    idx += step;
+	    rest -= tree[idx];
+	}
+    if (idx >= n)
+	return -1;	/* past the end */
+    if (lowp != NULL)
+	*lowp = lnum - rest + 1;
+    return idx;
+}
+
+/*
+ * Lookup line "lnum" with the leaf index, avoiding a walk through the pointer
+ * blocks.  The index is built when it is missing and lookups keep starting
+ * at the root of the tree.
+ * The found block is locked like ml_find_line() does, but the stack is not
+ * updated.
+ * Return NULL when the index can't be used, the tree has to be walked then.
+ */
+    static bhdr_T *
+ml_leaf_get(buf, lnum)
+    buf_T	*buf;
+    linenr_T	lnum;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    mlleaf_T	*lp;
+    linenr_T	low;
+    int		idx;
+
+    if (buf->b_ml.ml_leaf == NULL)
+    {
+	if (++buf->b_ml.ml_leaf_misses < ML_LEAF_MISSES)
+	    return NULL;
+	buf->b_ml.ml_leaf_misses = 0;
+	if (ml_leaf_build(buf) == FAIL)
+	    return NULL;
+    }
+
+    idx = ml_leaf_find(buf, lnum, &low);
+    if (idx < 0)
+	return NULL;
+    lp = &buf->b_ml.ml_leaf[idx];
+
+    /* A negative block number may have been translated, let ml_find_line()
+     * update the pointer block. */
+    if (lp->ll_bnum < 0)
+	return NULL;
+
+    if ((hp = mf_get(mfp, lp->ll_bnum, lp->ll_page_count)) == NULL)
+	return NULL;
+    dp = (DATA_BL *)(hp->bh_data);
+    if (dp->db_id != DATA_ID || dp->db_line_count != lp->ll_line_count)
+    {
+	/* Index doesn't match the tree, drop it. */
+	mf_put(mfp, hp, FALSE, FALSE);
+	ml_leaf_free(buf);
+	return NULL;
+    }
+
+    buf->b_ml.ml_locked = hp;
+    buf->b_ml.ml_locked_low = low;
+    buf->b_ml.ml_locked_high = low + lp->ll_line_count - 1;
+    buf->b_ml.ml_locked_lineadd = 0;
+    buf->b_ml.ml_locked_leaf = idx;
+    buf->b_ml.ml_flags = (buf->b_ml.ml_flags
+			      & ~(ML_LOCKED_DIRTY | ML_LOCKED_POS))
+							  | ML_LOCKED_INDEX;
+    buf->b_ml.ml_stack_top = 0;
+    return hp;
+}
+
+/*
+ * Called by ml_find_line() when data block "bnum" was found by walking the
+ * tree and was locked.  Remember where it is in the leaf index and account
+ * for the line that is going to be inserted or deleted.
+ */
+    static void
+ml_leaf_locked(buf, bnum, page_count, line_count, action)
+    buf_T	*buf;
+    blocknr_T	bnum;
+    int		page_count;
+    linenr_T	line_count;	/* lines in the block before the change */
+    int		action;
+{
+    mlleaf_T	*lp;
+    int		idx;
+
+    buf->b_ml.ml_locked_leaf = -1;
+    if (buf->b_ml.ml_leaf == NULL)
+	return;
+
+    idx = ml_leaf_find(buf, buf->b_ml.ml_locked_low, NULL);
+    if (idx < 0 || buf->b_ml.ml_leaf[idx].ll_line_count != line_count)
+    {
+	ml_leaf_free(buf);	/* out of sync, build it again later */
+	return;
+    }
+    lp = &buf->b_ml.ml_leaf[idx];
+    lp->ll_bnum = bnum;		/* may have been translated */
+    lp->ll_page_count = page_count;
+    buf->b_ml.ml_locked_leaf = idx;
+
+    if (action == ML_INSERT)
+	ml_leaf_lineadd(buf, 1);
+    else if (action == ML_DELETE)
+	ml_leaf_lineadd(buf, -1);
+}
+
+/*
+ * Add "count" to the number of lines of the locked block in the leaf index.
+ */
+    static void
+ml_leaf_lineadd(buf, count)
+    buf_T	*buf;
+    int		count;
+{
+    int		i;
+
+    if (buf->b_ml.ml_leaf == NULL || buf->b_ml.ml_locked_leaf < 0)
+	return;
+    buf->b_ml.ml_leaf[buf->b_ml.ml_locked_leaf].ll_line_count += count;
+    for (i = buf->b_ml.ml_locked_leaf + 1; i <= buf->b_ml.ml_leaf_count;
+								 i += i & -i)
+	buf->b_ml.ml_leaf_tree[i] += count;
+}
+
 /*
  * make swap file name out of the file name and a directory name
  */
@@ -3981,6 +4851,211 @@ ml_setdirty(buf, flag)
 #define MLCS_MAXL 800	/* max no of lines in chunk */
 #define MLCS_MINL 400   /* should be half of MLCS_MAXL */
 
+/*
+ * The chunks are indexed with two Fenwick trees, one for the number of lines
+ * and one for the number of bytes, so that the chunk for a line or byte
+ * offset is found in O(log n).  Changing the size of a chunk updates the
+ * trees and adding a chunk at the end extends them, both in O(log n).  The
+ * trees are allocated with the same spare room as ml_chunksize.  Splitting
+ * or joining chunks in the middle moves the entries in ml_chunksize and
+ * makes the trees invalid; they are then filled again in O(n) when needed,
+ * reusing the allocated memory.
+ */
+
+/*
+ * Free the chunk trees of "buf".
+ */
+    static void
+ml_chunk_free(buf)
+    buf_T	*buf;
+{
+    vim_free(buf->b_ml.ml_chunklines);
+    buf->b_ml.ml_chunklines = NULL;
+    vim_free(buf->b_ml.ml_chunkbytes);
+    buf->b_ml.ml_chunkbytes = NULL;
+    buf->b_ml.ml_chunktree_valid = FALSE;
+    buf->b_ml.ml_chunktree_size = 0;
+}
+
+/*
+ * Make sure the chunk trees of "buf" are valid, build them when needed.
+ * Return FAIL when out of memory.
+ */
+    static int
+ml_chunk_tree(buf)
+    buf_T	*buf;
+{
+    int		n = buf->b_ml.ml_usedchunks;
+    int		i;
+    int		j;
+    int		size;
+
+    if (buf->b_ml.ml_chunktree_valid)
+	return OK;
+    if (buf->b_ml.ml_chunktree_size < n + 1)
+    {
+	ml_chunk_free(buf);
+	size = buf->b_ml.ml_numchunks + 1;
+	if (size < n + 1)
+	    size = n + 1;
+	buf->b_ml.ml_chunklines = (linenr_T *)alloc(
+				      (unsigned)(sizeof(linenr_T) * size));
+	buf->b_ml.ml_chunkbytes = (long *)alloc(
+					  (unsigned)(sizeof(long) * size));
+	if (buf->b_ml.ml_chunklines == NULL
+					|| buf->b_ml.ml_chunkbytes == NULL)
+	{
+	    ml_chunk_free(buf);
+	    return FAIL;
+	}
+	buf->b_ml.ml_chunktree_size = size;
+    }
+    for (i = 1; i <= n; ++i)
+    {
+	buf->b_ml.ml_chunklines[i] = buf->b_ml.ml_chunksize[i - 1].mlcs_numlines;
+	buf->b_ml.ml_chunkbytes[i] = buf->b_ml.ml_chunksize[i - 1].mlcs_totalsize;
+    }
+    /* add each node to its parent, O(n) */
+    for (i = 1; i <= n; ++i)
+    {
+	j = i + (i & -i);
+	if (j <= n)
+	{
+	    buf->b_ml.ml_chunklines[j] += buf->b_ml.ml_chunklines[i];
+	    buf->b_ml.ml_chunkbytes[j] += buf->b_ml.ml_chunkbytes[i];
+	}
+    }
+    buf->b_ml.ml_chunktree_valid = TRUE;
+    return OK;
+}
+
+/*
+ * Chunk "ix" got "lines" more lines and "bytes" more bytes.
+ */
+    static void
+ml_chunk_add(buf, ix, lines, bytes)
+    buf_T	*buf;
+    int		ix;
+    int		lines;
+    long	bytes;
+{
+    int		i;
+
+    if (!buf->b_ml.ml_chunktree_valid)
+	return;		/* will be built from ml_chunksize later */
+    for (i = ix + 1; i <= buf->b_ml.ml_usedchunks; i += i & -i)
+    {
+	buf->b_ml.ml_chunklines[i] += lines;
+	buf->b_ml.ml_chunkbytes[i] += bytes;
+    }
+}
+
+/*
+ * A chunk was added at the end of ml_chunksize: add it to the trees.
+ */
+    static void
+ml_chunk_append(buf)
+    buf_T	*buf;
+{
+    int		n = buf->b_ml.ml_usedchunks;
+    int		i;
+    int		size;
+    linenr_T	*newlines;
+    long	*newbytes;
+
+    if (!buf->b_ml.ml_chunktree_valid)
+	return;		/* will be built from ml_chunksize later */
+    if (buf->b_ml.ml_chunktree_size < n + 1)
+    {
+	size = buf->b_ml.ml_numchunks + 1;
+	if (size < n + 1)
+	    size = n + 1;
+	newlines = (linenr_T *)vim_realloc(buf->b_ml.ml_chunklines,
+						     sizeof(linenr_T) * size);
+	if (newlines != NULL)
+	    buf->b_ml.ml_chunklines = newlines;
+	newbytes = (long *)vim_realloc(buf->b_ml.ml_chunkbytes,
+							 sizeof(long) * size);
+	if (newbytes != NULL)
+	    buf->b_ml.ml_chunkbytes = newbytes;
+	if (newlines == NULL || newbytes == NULL)
+	{
+	    ml_chunk_free(buf);
+	    return;
+	}
+	buf->b_ml.ml_chunktree_size = size;
+    }
+
+    /* Node "n" covers the chunk itself and the nodes below it. */
+    buf->b_ml.ml_chunklines[n] = buf->b_ml.ml_chunksize[n - 1].mlcs_numlines;
+    buf->b_ml.ml_chunkbytes[n] = buf->b_ml.ml_chunksize[n - 1].mlcs_totalsize;
+    for (i = n - 1; i > n - (n & -n); i -= i & -i)
+    {
+	buf->b_ml.ml_chunklines[n] += buf->b_ml.ml_chunklines[i];
+	buf->b_ml.ml_chunkbytes[n] += buf->b_ml.ml_chunkbytes[i];
+    }
+}
+
+/*
+ * Return the largest number of leading chunks that together have less than
+ * "target" lines, or, when "bytes" is TRUE, less than "target" bytes.  With
+ * "ffdos" one byte per line is added for the CR.
+ * The chunk trees must be valid.
+ */
+    static int
+ml_chunk_find(buf, target, bytes, ffdos)
+    buf_T	*buf;
+    long	target;
+    int		bytes;
+    int		ffdos;
+{
+    int		n = buf->b_ml.ml_usedchunks;
+    int		bit = 1;
+    int		pos = 0;
+    long	sum = 0;
+    long	val;
+
+    while (bit * 2 <= n)
+	bit *= 2;
+    for ( ; bit > 0; bit /= 2)
+    {
+	if (pos + bit > n)
+	    continue;
+	val = buf->b_ml.ml_chunklines[pos + bit];
+	if (bytes)
+	    val = buf->b_ml.ml_chunkbytes[pos + bit] + (ffdos ? val : 0);
+	if (sum + val < target)
+	{
+	    pos += bit;
+	    sum += val;
+	}
+    }
+    return pos;
+}
+
+/*
+ * Return the number of lines in the first "count" chunks, and the number of
+ * bytes in "*bytesp".  The chunk trees must be valid.
+ */
+    static linenr_T
+ml_chunk_sum(buf, count, bytesp)
+    buf_T	*buf;
+    int		count;
+    long	*bytesp;
+{
+    linenr_T	lines = 0;
+    long	bytes = 0;
+    int		i;
+
+    for (i = count; i > 0; i -= i & -i)
+    {
+	lines += buf->b_ml.ml_chunklines[i];
+	bytes += buf->b_ml.ml_chunkbytes[i];
+    }
+    *bytesp = bytes;
+    return lines;
+}
+
 /*
  * Keep information for finding byte offset of a line, updtytpe may be one of:
  * ML_CHNK_ADDLINE: Add len to parent chunk, possibly splitting it
@@ -3995,13 +5070,8 @@ ml_updatechunk(buf, line, len, updtype)
     long	len;
     int		updtype;
 {
-    static buf_T	*ml_upd_lastbuf = NULL;
-    static linenr_T	ml_upd_lastline;
-    static linenr_T	ml_upd_lastcurline;
-    static int		ml_upd_lastcurix;
-
-    linenr_T		curline = ml_upd_lastcurline;
-    int			curix = ml_upd_lastcurix;
+    linenr_T		curline;
+    int			curix;
     long		size;
     chunksize_T		*curchnk;
     int			rest;
@@ -4023,6 +5093,7 @@ ml_updatechunk(buf, line, len, updtype)
 	buf->b_ml.ml_usedchunks = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_totalsize = 1;
+	buf->b_ml.ml_chunktree_valid = FALSE;
     }
 
     if (updtype == ML_CHNK_UPDLINE && buf->b_ml.ml_line_count == 1)
@@ -4034,6 +5105,7 @@ ml_updatechunk(buf, line, len, updtype)
 	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_totalsize =
 				  (long)STRLEN(buf->b_ml.ml_line_ptr) + 1;
+	buf->b_ml.ml_chunktree_valid = FALSE;
 	return;
     }
 
@@ -4041,32 +5113,25 @@ ml_updatechunk(buf, line, len, updtype)
      * Find chunk that our line belongs to, curline will be at start of the
      * chunk.
      */
-    if (buf != ml_upd_lastbuf || line != ml_upd_lastline + 1
-	    || updtype != ML_CHNK_ADDLINE)
+    if (ml_chunk_tree(buf) == FAIL)
     {
-	for (curline = 1, curix = 0;
-	     curix < buf->b_ml.ml_usedchunks - 1
-	     && line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	     curix++)
-	{
-	    curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	}
-    }
-    else if (line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines
-		 && curix < buf->b_ml.ml_usedchunks - 1)
-    {
-	/* Adjust cached curix & curline */
-	curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	curix++;
+	buf->b_ml.ml_usedchunks = -1;
+	return;
     }
+    curix = ml_chunk_find(buf, (long)line, FALSE, FALSE);
+    if (curix > buf->b_ml.ml_usedchunks - 1)
+	curix = buf->b_ml.ml_usedchunks - 1;
+    curline = ml_chunk_sum(buf, curix, &size) + 1;
     curchnk = buf->b_ml.ml_chunksize + curix;
 
     if (updtype == ML_CHNK_DELLINE)
 	len *= -1;
     curchnk->mlcs_totalsize += len;
+    ml_chunk_add(buf, curix, 0, len);
     if (updtype == ML_CHNK_ADDLINE)
     {
 	curchnk->mlcs_numlines++;
+	ml_chunk_add(buf, curix, 1, 0L);
 
 	/* May resize here so we don't have to do it in both cases below */
 	if (buf->b_ml.ml_usedchunks + 1 >= buf->b_ml.ml_numchunks)
@@ -4133,7 +5198,7 @@ ml_updatechunk(buf, line, len, updtype)
 	    buf->b_ml.ml_chunksize[curix].mlcs_totalsize = size;
 	    buf->b_ml.ml_chunksize[curix + 1].mlcs_totalsize -= size;
 	    buf->b_ml.ml_usedchunks++;
-	    ml_upd_lastbuf = NULL;   /* Force recalc of curix & curline */
+	    buf->b_ml.ml_chunktree_valid = FALSE;
 	    return;
 	}
 	else if (buf->b_ml.ml_chunksize[curix].mlcs_numlines >= MLCS_MINL
@@ -4145,7 +5210,6 @@ ml_updatechunk(buf, line, len, updtype)
 	     * after this. Do it now to avoid the loop above later on
 	     */
 	    curchnk = buf->b_ml.ml_chunksize + curix + 1;
-	    buf->b_ml.ml_usedchunks++;
 	    if (line == buf->b_ml.ml_line_count)
 	    {
 		curchnk->mlcs_numlines = 0;
@@ -4174,13 +5238,16 @@ ml_updatechunk(buf, line, len, updtype)
 		curchnk->mlcs_numlines = 1;
 		curchnk[-1].mlcs_totalsize -= rest;
 		curchnk[-1].mlcs_numlines -= 1;
+		ml_chunk_add(buf, curix, -1, -(long)rest);
 	    }
+	    buf->b_ml.ml_usedchunks++;
+	    ml_chunk_append(buf);
 	}
     }
     else if (updtype == ML_CHNK_DELLINE)
     {
 	curchnk->mlcs_numlines--;
-	ml_upd_lastbuf = NULL;   /* Force recalc of curix & curline */
+	ml_chunk_add(buf, curix, -1, 0L);
 	if (curix < (buf->b_ml.ml_usedchunks - 1)
 		&& (curchnk->mlcs_numlines + curchnk[1].mlcs_numlines)
 		   <= MLCS_MINL)
@@ -4191,6 +5258,7 @@ ml_updatechunk(buf, line, len, updtype)
 	else if (curix == 0 && curchnk->mlcs_numlines <= 0)
 	{
 	    buf->b_ml.ml_usedchunks--;
+	    buf->b_ml.ml_chunktree_valid = FALSE;
 	    mch_memmove(buf->b_ml.ml_chunksize, buf->b_ml.ml_chunksize + 1,
 			buf->b_ml.ml_usedchunks * sizeof(chunksize_T));
 	    return;
@@ -4206,6 +5274,7 @@ ml_updatechunk(buf, line, len, updtype)
 	curchnk[-1].mlcs_numlines += curchnk->mlcs_numlines;
 	curchnk[-1].mlcs_totalsize += curchnk->mlcs_totalsize;
 	buf->b_ml.ml_usedchunks--;
+	buf->b_ml.ml_chunktree_valid = FALSE;
 	if (curix < buf->b_ml.ml_usedchunks)
 	{
 	    mch_memmove(buf->b_ml.ml_chunksize + curix,
@@ -4215,10 +5284,6 @@ ml_updatechunk(buf, line, len, updtype)
 	}
 	return;
     }
-    ml_upd_lastbuf = buf;
-    ml_upd_lastline = line;
-    ml_upd_lastcurline = curline;
-    ml_upd_lastcurix = curix;
 }
 
 /*
@@ -4235,6 +5300,7 @@ ml_find_line_or_offset(buf, line, offp)
 {
     linenr_T	curline;
     int		curix;
+    int		i;
     long	size;
     bhdr_T	*hp;
     DATA_BL	*dp;
@@ -4259,24 +5325,25 @@ ml_find_line_or_offset(buf, line, offp)
     if (line == 0 && offset <= 0)
 	return 1;   /* Not a "find offset" and offset 0 _must_ be in line 1 */
     /*
-     * Find the last chunk before the one containing our line. Last chunk is
-     * special because it will never qualify
+     * Find the chunk containing our line or offset. Last chunk is special
+     * because it will never qualify
      */
-    curline = 1;
-    curix = size = 0;
-    while (curix < buf->b_ml.ml_usedchunks - 1
-	    && ((line != 0
-	     && line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines)
-		|| (offset != 0
-	       && offset > size + buf->b_ml.ml_chunksize[curix].mlcs_totalsize
-		      + ffdos * buf->b_ml.ml_chunksize[curix].mlcs_numlines)))
+    if (ml_chunk_tree(buf) == FAIL)
+	return -1;
+    curix = 0;
+    if (line != 0)
+	curix = ml_chunk_find(buf, (long)line, FALSE, FALSE);
+    if (offset != 0)
     {
-	curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	size += buf->b_ml.ml_chunksize[curix].mlcs_totalsize;
-	if (offset && ffdos)
-	    size += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	curix++;
+	i = ml_chunk_find(buf, offset, TRUE, ffdos);
+	if (i > curix)
+	    curix = i;
     }
+    if (curix > buf->b_ml.ml_usedchunks - 1)
+	curix = buf->b_ml.ml_usedchunks - 1;
+    curline = ml_chunk_sum(buf, curix, &size) + 1;
+    if (offset && ffdos)
+	size += curline - 1;
 
     while ((line != 0 && curline < line) || (offset != 0 && size < offset))
     {
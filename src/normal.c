@@ -712,8 +712,7 @@ getcount:
  * Cursor motions
  */
     case 'G':
-	nv_goto(oap, ca.count0 == 0 ? (long)curbuf->b_ml.ml_line_count
-				    : ca.count0);
+	nv_goto(oap, ca.count0 == 0 ? (long)MAXLNUM : ca.count0);
 	break;
 
     case 'H':
@@ -852,7 +851,7 @@ getcount:
     case K_XEND:
     case K_S_END:
 	if ((mod_mask & MOD_MASK_CTRL))	    /* CTRL-END = goto last line */
-	    nv_goto(oap, curbuf->b_ml.ml_line_count);
+	    nv_goto(oap, (long)MAXLNUM);
 	/* FALLTHROUGH */
 
     case '$':
@@ -5614,7 +5613,12 @@ nv_goto(oap, lnum)
     if (lnum < 1L)
 	lnum = 1L;
     else if (lnum > curbuf->b_ml.ml_line_count)
-	lnum = curbuf->b_ml.ml_line_count;
+    {
+	/* The line may not have been read yet. */
+	readfile_lazy(curbuf, (linenr_t)lnum);
+	if (lnum > curbuf->b_ml.ml_line_count)
+	    lnum = curbuf->b_ml.ml_line_count;
+    }
     curwin->w_cursor.lnum = lnum;
     beginline(BL_SOL | BL_FIX);
 }
@@ -113,6 +113,7 @@ enum indirect_options
     PV_TS,
     PV_TW,
     PV_TX,
+    PV_UM,
     PV_WM,
     PV_WRAP
 };
@@ -1277,6 +1278,9 @@ static struct vimoption options[] =
 			    (char_u *)100L,
 #endif
 				(char_u *)0L}},
+    {"undomem",	    "um",   P_NUM|P_IND|P_VI_DEF|P_VIM,
+			    (char_u *)PV_UM,
+			    {(char_u *)0L, (char_u *)0L}},
     {"updatecount", "uc",   P_NUM|P_VI_DEF,
 			    (char_u *)&p_uc,
 			    {(char_u *)200L, (char_u *)0L}},
@@ -4144,6 +4148,11 @@ set_num_option(opt_idx, varp, value, errbuf)
 	errmsg = e_positive;
 	curbuf->b_p_tw = 0;
     }
+    if (curbuf->b_p_um < 0)
+    {
+	errmsg = e_positive;
+	curbuf->b_p_um = 0;
+    }
     if (p_tm < 0)
     {
 	errmsg = e_positive;
@@ -4878,6 +4887,7 @@ get_varp(p)
 	case PV_TS:	return (char_u *)&(curbuf->b_p_ts);
 	case PV_TW:	return (char_u *)&(curbuf->b_p_tw);
 	case PV_TX:	return (char_u *)&(curbuf->b_p_tx);
+	case PV_UM:	return (char_u *)&(curbuf->b_p_um);
 	case PV_WM:	return (char_u *)&(curbuf->b_p_wm);
 	default:	EMSG("get_varp ERROR");
     }
@@ -4996,6 +5006,7 @@ buf_copy_options(bp_from, bp_to, flags)
 	    bp_to->b_p_wm = bp_from->b_p_wm;
 	    bp_to->b_p_wm_save = bp_from->b_p_wm_save;
 	    bp_to->b_p_wm_nobin = bp_from->b_p_wm_nobin;
+	    bp_to->b_p_um = bp_from->b_p_um;
 	    bp_to->b_p_bin = bp_from->b_p_bin;
 	    bp_to->b_p_et = bp_from->b_p_et;
 	    bp_to->b_p_et_nobin = bp_from->b_p_et_nobin;
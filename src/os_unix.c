@@ -528,6 +528,7 @@ deathtrap SIGDEFARG(sigarg)
 
     full_screen = FALSE;	/* don't write message to the GUI, it might be
 				 * part of the problem... */
+    in_deathtrap = TRUE;	/* don't wait for locks, see ml_sync_wait() */
     /*
      * If something goes wrong after entering here, we may get here again.
      * When this happens, give a message and try to exit nicely (resetting the
@@ -1,6 +1,10 @@
 /* fileio.c */
 void filemess __ARGS((buf_T *buf, char_u *name, char_u *s, int attr));
 int readfile __ARGS((char_u *fname, char_u *sfname, linenr_T from, linenr_T lines_to_skip, linenr_T lines_to_read, exarg_T *eap, int flags));
+void readfile_lazy __ARGS((buf_T *buf, linenr_T lnum));
+void readfile_lazy_free __ARGS((buf_T *buf));
+int readfile_lazy_modeline __ARGS((buf_T *buf, int count));
+void readfile_idle __ARGS((void));
 int prep_exarg __ARGS((exarg_T *eap, buf_T *buf));
 int buf_write __ARGS((buf_T *buf, char_u *fname, char_u *sfname, linenr_T start, linenr_T end, exarg_T *eap, int append, int forceit, int reset_changed, int filtering));
 char_u *shorten_fname __ARGS((char_u *full_path, char_u *dir_name));
@@ -26,6 +30,7 @@ void aucmd_restbuf __ARGS((aco_save_T *aco));
 int apply_autocmds __ARGS((EVENT_T event, char_u *fname, char_u *fname_io, int force, buf_T *buf));
 int apply_autocmds_retval __ARGS((EVENT_T event, char_u *fname, char_u *fname_io, int force, buf_T *buf, int *retval));
 int has_cursorhold __ARGS((void));
+int has_bufreadpost __ARGS((void));
 int has_autocmd __ARGS((EVENT_T event, char_u *sfname));
 char_u *get_augroup_name __ARGS((expand_T *xp, int idx));
 char_u *set_context_in_autocmd __ARGS((expand_T *xp, char_u *arg, int doautocmd));
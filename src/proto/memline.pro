@@ -19,8 +19,10 @@ char_u *ml_get_cursor __ARGS((void));
 char_u *ml_get_buf __ARGS((buf_T *buf, linenr_T lnum, int will_change));
 int ml_line_alloced __ARGS((void));
 int ml_append __ARGS((linenr_T lnum, char_u *line, colnr_T len, int newfile));
+long ml_append_lines __ARGS((linenr_T lnum, char_u **lines, colnr_T *lens, long count, int newfile));
 int ml_replace __ARGS((linenr_T lnum, char_u *line, int copy));
 int ml_delete __ARGS((linenr_T lnum, int message));
+int ml_delete_range __ARGS((linenr_T lnum, long count, int message));
 void ml_setmarked __ARGS((linenr_T lnum));
 linenr_T ml_firstmarked __ARGS((void));
 void ml_clearmarked __ARGS((void));
@@ -4,6 +4,7 @@ void syn_stack_free_all __ARGS((buf_T *buf));
 void syn_stack_apply_changes __ARGS((buf_T *buf));
 void syntax_end_parsing __ARGS((linenr_T lnum));
 int syntax_check_changed __ARGS((linenr_T lnum));
+void syntax_idle __ARGS((void));
 int get_syntax_attr __ARGS((colnr_T col));
 void syntax_clear __ARGS((buf_T *buf));
 void ex_syntax __ARGS((exarg_T *eap));
@@ -135,6 +135,8 @@ static void copy_text_attr __ARGS((int off, char_u *buf, int len, int attr));
 #endif
 static int win_line __ARGS((win_T *, linenr_T, int, int));
 static int char_needs_redraw __ARGS((int off_from, int off_to, int cols));
+static int cells_equal __ARGS((unsigned off_from, unsigned off_to, int cols));
+static int equal_cells_len __ARGS((unsigned off_from, unsigned off_to, int cols));
 #ifdef FEAT_RIGHTLEFT
 static void screen_line __ARGS((int row, int coloff, int endcol, int clear_width, int rlflag));
 # define SCREEN_LINE(r, o, e, c, rl)    screen_line((r), (o), (e), (c), (rl))
@@ -4177,6 +4179,87 @@ char_needs_redraw(off_from, off_to, cols)
     return FALSE;
 }
 
+/*
+ * Return TRUE when "cols" screen cells at "off_from" and "off_to" are
+ * equal: characters, attributes and, for UTF-8, composing characters.
+ */
+    static int
+cells_equal(off_from, off_to, cols)
+    unsigned	off_from;
+    unsigned	off_to;
+    int		cols;
+{
+#ifdef FEAT_MBYTE
+    int		i;
+#endif
+
+    if (vim_memcmp(ScreenLines + off_from, ScreenLines + off_to,
+				  (size_t)cols * sizeof(ScreenLines[0])) != 0
+	    || vim_memcmp(ScreenAttrs + off_from, ScreenAttrs + off_to,
+				  (size_t)cols * sizeof(ScreenAttrs[0])) != 0)
+	return FALSE;
+#ifdef FEAT_MBYTE
+    if (enc_utf8)
+    {
+	if (vim_memcmp(ScreenLinesUC + off_from, ScreenLinesUC + off_to,
+				(size_t)cols * sizeof(ScreenLinesUC[0])) != 0)
+	    return FALSE;
+	/* Composing characters only matter for a UTF-8 character, like in
+	 * char_needs_redraw(). */
+	for (i = 0; i < cols; ++i)
+	    if (ScreenLinesUC[off_from + i] != 0
+		    && (ScreenLinesC1[off_from + i] != ScreenLinesC1[off_to + i]
+			|| ScreenLinesC2[off_from + i]
+						 != ScreenLinesC2[off_to + i]))
+		return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+/*
+ * Return the number of equal cells at "off_from" and "off_to", at most
+ * "cols".  The first cell must be known to be equal.
+ * After a cell was found equal by itself the following cells are compared
+ * as a block with memcmp(), which is a lot faster than comparing cell by
+ * cell.  Thus a changed cell right after an equal one doesn't cost a block
+ * compare, and only the block with a difference is done one cell at a time.
+ * Not for DBCS, where a cell may be the second byte of a character.
+ */
+#define EQUAL_CELLS_BLOCK   32
+
+    static int
+equal_cells_len(off_from, off_to, cols)
+    unsigned	off_from;
+    unsigned	off_to;
+    int		cols;
+{
+    int		n = 1;
+    int		len;
+    int		end;
+
+    while (n < cols && cells_equal(off_from + n, off_to + n, 1))
+    {
+	++n;
+	len = cols - n;
+	if (len > EQUAL_CELLS_BLOCK)
+	    len = EQUAL_CELLS_BLOCK;
+	if (cells_equal(off_from + n, off_to + n, len))
+	    n += len;
+	else
+	{
+	    /* find the difference in this block */
+	    end = n + len;
+	    while (n < end && cells_equal(off_from + n, off_to + n, 1))
+		++n;
+	    break;
+	}
+    }
+    if (n > cols)
+	n = cols;
+    return n;
+}
+
 /*
  * Move one "cooked" screen line to the screen, but only the characters that
  * have actually changed.  Handle insert/delete character.
@@ -4215,6 +4298,7 @@ screen_line(row, coloff, endcol, clear_width
 #endif
 				;
     int		    redraw_next;	/* redraw_this for next character */
+    int		    skip;		/* number of unchanged cells */
 #ifdef FEAT_MBYTE
     int		    clear_next = FALSE;
     int		    char_cells;		/* 1: normal char */
@@ -4262,6 +4346,32 @@ screen_line(row, coloff, endcol, clear_width
 
     while (col < endcol)
     {
+	/*
+	 * Skip over cells that didn't change, except the last one, it's
+	 * handled below to check the next character.  Not when 'xs' is set,
+	 * it needs to check the attributes of every character.
+	 */
+	if (!redraw_next && !force && !p_wiv
+#ifdef FEAT_MBYTE
+		&& (!has_mbyte || enc_utf8)
+#endif
+		)
+	{
+	    skip = equal_cells_len(off_from, off_to, endcol - col) - 1;
+#ifdef FEAT_MBYTE
+	    /* Don't stop at the right halve of a double-wide character. */
+	    if (skip > 0 && has_mbyte
+			       && (*mb_off2cells)(off_from + skip - 1) > 1)
+		--skip;
+#endif
+	    if (skip > 0)
+	    {
+		off_from += skip;
+		off_to += skip;
+		col += skip;
+	    }
+	}
+
 #ifdef FEAT_MBYTE
 	if (has_mbyte && (col + 1 < endcol))
 	    char_cells = (*mb_off2cells)(off_from);
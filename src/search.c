@@ -379,6 +379,9 @@ searchit(buf, pos, dir, str, count, options, pat_use)
 	return FAIL;
     }
 
+    /* Search all lines, also the ones of a file that was not read yet. */
+    readfile_lazy(buf, MAXLNUM);
+
     if (options & SEARCH_START)
 	extra_col = 0;
     else
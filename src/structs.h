@@ -239,6 +239,8 @@ struct u_entry
     linenr_T	ue_lcount;	/* linecount when u_save called */
     char_u	**ue_array;	/* array of lines in undo block */
     long	ue_size;	/* number of lines in ue_array */
+    long	ue_room;	/* number of allocated entries in ue_array */
+    int		ue_delta;	/* ue_array has deltas, see u_delta_head() */
 };
 
 struct u_header
@@ -247,6 +249,8 @@ struct u_header
     u_header_T	*uh_prev;	/* pointer to previous header in list */
     u_entry_T	*uh_entry;	/* pointer to first entry */
     u_entry_T	*uh_getbot_entry; /* pointer to where ue_bot must be set */
+    long	uh_spill;	/* offset of entries in spill file, -1 when
+				   they are in memory */
     pos_T	uh_cursor;	/* cursor position before saving */
 #ifdef FEAT_VIRTUALEDIT
     long	uh_cursor_vcol;
@@ -273,6 +277,16 @@ struct u_header
 
 typedef struct m_info minfo_T;
 
+/*
+ * Chunks are handed out in size classes: steps of 16 bytes up to 512 bytes,
+ * then powers of two up to U_SLAB_MAX.  Larger chunks get a block of their
+ * own.
+ */
+#define U_CLASS_SMALL	32	/* number of 16 byte step classes */
+#define U_CLASS_STEP	16
+#define U_SLAB_MAX	2048	/* largest chunk taken from a slab */
+#define U_NCLASSES	(U_CLASS_SMALL + 2)
+
 /*
  * stucture used to link chunks in one of the free chunk lists.
  */
@@ -283,7 +297,7 @@ struct m_info
 #else
     short_u	m_size;		/* size of the chunk (including m_info) */
 #endif
-    minfo_T	*m_next;	/* pointer to next free chunk in the list */
+    minfo_T	*m_next;	/* pointer to next free chunk of this class */
 };
 
 /*
@@ -293,8 +307,8 @@ typedef struct m_block mblock_T;
 struct m_block
 {
     mblock_T	*mb_next;	/* pointer to next allocated block */
+    mblock_T	*mb_prev;	/* pointer to previous allocated block */
     size_t	mb_size;	/* total size of all chunks in this block */
-    minfo_T	mb_info;	/* head of free chuck list for this block */
 };
 
 /*
@@ -408,9 +422,10 @@ typedef struct
 
 /*
  * Simplistic hashing scheme to quickly locate the blocks in the used list.
- * 64 blocks are found directly (64 * 4K = 256K, most files are smaller).
+ * 256 blocks are found directly (256 * 4K = 1M), larger files only get short
+ * hash chains.  Must be a power of two.
  */
-#define MEMHASHSIZE	64
+#define MEMHASHSIZE	256
 #define MEMHASH(nr)	((nr) & (MEMHASHSIZE - 1))
 
 struct memfile
@@ -449,6 +464,18 @@ typedef struct info_pointer
     int		ip_index;	/* index for block with current lnum */
 } infoptr_T;	/* block/index pair */
 
+/*
+ * Index of all data blocks in the tree, in line order.  Used to go from a line
+ * number to its data block without walking the pointer blocks.  ml_leaf_tree
+ * is a Fenwick tree over ll_line_count, giving O(log n) lookup and update.
+ */
+typedef struct ml_leaf
+{
+    blocknr_T	ll_bnum;	/* data block number */
+    int		ll_page_count;	/* number of pages in the data block */
+    linenr_T	ll_line_count;	/* number of lines in the data block */
+} mlleaf_T;
+
 #ifdef FEAT_BYTEOFF
 typedef struct ml_chunksize
 {
@@ -476,6 +503,8 @@ typedef struct memline
 #define ML_LINE_DIRTY	2	/* cached line was changed and allocated */
 #define ML_LOCKED_DIRTY	4	/* ml_locked was changed */
 #define ML_LOCKED_POS	8	/* ml_locked needs positive block number */
+#define ML_LOCKED_INDEX	16	/* ml_locked was found with ml_leaf, the
+				   stack does not lead to it */
     int		ml_flags;
 
     infoptr_T	*ml_stack;	/* stack of pointer blocks (array of IPTRs) */
@@ -489,10 +518,24 @@ typedef struct memline
     linenr_T	ml_locked_low;	/* first line in ml_locked */
     linenr_T	ml_locked_high;	/* last line in ml_locked */
     int		ml_locked_lineadd;  /* number of lines inserted in ml_locked */
+    int		ml_locked_leaf;	/* index of ml_locked in ml_leaf, -1 if not
+				   known */
+
+    mlleaf_T	*ml_leaf;	/* index of data blocks, NULL if not valid */
+    linenr_T	*ml_leaf_tree;	/* Fenwick tree for ml_leaf (1-based) */
+    int		ml_leaf_count;	/* number of entries in ml_leaf */
+    int		ml_leaf_misses;	/* far lookups since ml_leaf became invalid */
+
+    struct lazyread *ml_lazy;	/* rest of a file that readfile() did not
+				   append yet, NULL when complete */
 #ifdef FEAT_BYTEOFF
     chunksize_T *ml_chunksize;
     int		ml_numchunks;
     int		ml_usedchunks;
+    linenr_T	*ml_chunklines;	/* Fenwick tree of mlcs_numlines (1-based) */
+    long	*ml_chunkbytes;	/* Fenwick tree of mlcs_totalsize (1-based) */
+    int		ml_chunktree_valid; /* trees match ml_chunksize */
+    int		ml_chunktree_size; /* allocated entries in the trees */
 #endif
 } memline_T;
 
@@ -983,6 +1026,10 @@ struct file_buffer
     u_header_T	*b_u_curhead;	/* pointer to current header */
     int		b_u_numhead;	/* current number of headers */
     int		b_u_synced;	/* entry lists are synced */
+    FILE	*b_u_spill_fd;	/* file with spilled entry lists or NULL */
+    char_u	*b_u_spill_fname; /* name of b_u_spill_fd */
+    int		b_u_spilled;	/* number of headers in b_u_spill_fd */
+    int		b_u_spill_err;	/* writing b_u_spill_fd failed */
 
     /*
      * variables for "U" command in undo.c
@@ -995,9 +1042,10 @@ struct file_buffer
      * The following only used in undo.c
      */
     mblock_T	b_block_head;	/* head of allocated memory block list */
-    minfo_T	*b_m_search;	/* pointer to chunk before previously
-				   allocated/freed chunk */
-    mblock_T	*b_mb_current;	/* block where m_search points in */
+    minfo_T	*b_m_free[U_NCLASSES]; /* free chunk list for each size class */
+    char_u	*b_m_slab;	/* unused memory in the last slab block */
+    long_u	b_m_slab_left;	/* number of bytes at b_m_slab */
+    long_u	b_m_used;	/* bytes in chunks in use */
 #ifdef FEAT_INS_EXPAND
     int		b_scanned;	/* ^N/^P have scanned this buffer */
 #endif
@@ -1120,6 +1168,7 @@ struct file_buffer
     long	b_p_tw;		/* 'textwidth' */
     long	b_p_tw_nobin;	/* b_p_tw saved for binary mode */
     long	b_p_tw_nopaste;	/* b_p_tw saved for paste mode */
+    long	b_p_um;		/* 'undomem' */
     long	b_p_wm;		/* 'wrapmargin' */
     long	b_p_wm_nobin;	/* b_p_wm saved for binary mode */
     long	b_p_wm_nopaste;	/* b_p_wm saved for paste mode */
@@ -1226,6 +1275,16 @@ struct file_buffer
     int		b_sst_freecount;
     linenr_T	b_sst_check_lnum;
     short_u	b_sst_lasttick;	/* last display tick */
+
+    /* sparse store of states for the whole buffer, see syntax.c */
+    struct syn_chkpt *b_syn_chk;	/* entries sorted on line number */
+    int		b_syn_chk_len;		/* number of used entries */
+    int		b_syn_chk_size;		/* number of allocated entries */
+    long	b_syn_chk_tick;		/* for least recently used entry */
+    linenr_T	b_syn_idle_lnum;	/* where syntax_idle() continues */
+    struct syn_attr_line *b_syn_attr;	/* attributes of drawn lines */
+    int		b_syn_attr_tick;	/* b_changedtick for b_syn_attr[] and
+					   b_syn_chk[] */
 #endif /* FEAT_SYN_HL */
 
 #ifdef FEAT_SIGNS
@@ -122,6 +122,23 @@ static char *(spo_name_tab[SPO_COUNT]) =
  * A character offset can be given for the matched text (_m_start and _m_end)
  * and for the actually highlighted text (_h_start and _h_end).
  */
+#define SYN_LIT_LEN	8	/* size of sp_lit[], including the NUL */
+
+#if defined(HAVE_GETTIMEOFDAY) && defined(HAVE_SYS_TIME_H)
+# define SYN_TIME		/* ":syntax time" is available */
+#endif
+
+/*
+ * Counters for ":syntax time", kept for every pattern.
+ */
+struct syn_time
+{
+    long	st_count;	/* number of times syn_regexec() was called */
+    long	st_match;	/* number of times it matched */
+    long	st_total;	/* total time used, in usec */
+    long	st_slowest;	/* time used for the slowest call, in usec */
+};
+
 struct syn_pattern
 {
     char		 sp_type;	    /* see SPTYPE_ defines below */
@@ -140,8 +157,30 @@ struct syn_pattern
     int			 sp_sync_idx;	    /* sync item index (syncing only) */
     int			 sp_line_id;	    /* ID of last line where tried */
     int			 sp_startcol;	    /* next match in sp_line_id line */
+    char_u		 sp_lit[SYN_LIT_LEN]; /* literal every match contains */
+    char		 sp_lit_ic;	    /* sp_lit[] is lower case */
+    struct syn_time	 sp_time;	    /* for ":syntax time" */
 };
 
+/*
+ * Compiled patterns are shared between buffers: when a syntax file is loaded
+ * for several buffers, each pattern is compiled once.  The programs are kept
+ * in a hash table on the pattern text, with the buffers that use them.  Items
+ * of one buffer never share a program, the match positions are stored in it
+ * and may still be needed after trying another item.
+ */
+#define SYN_PROG_HASH	256	/* must be a power of two */
+
+struct syn_progent
+{
+    struct syn_progent	*pe_next;	/* next entry in the hash chain */
+    vim_regexp		*pe_prog;	/* compiled program */
+    struct growarray	pe_users;	/* buffers using pe_prog */
+    char_u		pe_pattern[1];	/* pattern text, actually longer */
+};
+
+static struct syn_progent *syn_prog_hash[SYN_PROG_HASH];
+
 /* The sp_off_flags are computed like this:
  * offset from the start of the matched text: (1 << SPO_XX_OFF)
  * offset from the end	 of the matched text: (1 << (SPO_XX_OFF + SPO_COUNT))
@@ -187,11 +226,16 @@ struct buf_state
 #define SYN_STATE_P(ssp)    ((struct buf_state *)((ssp)->ga_data))
 
 /*
- * Settings for keyword hash table.  It uses a simplistic hash function: add
- * all characters together, modulo KHASH_SIZE.
+ * Settings for keyword hash table.  The hash function is FNV-1a, adding
+ * one character at a time, so that check_keyword_id() can compute it while
+ * finding the end of the word.  Just adding the characters together made
+ * keywords of the same length and similar letters end up in a few long
+ * chains.
  */
 #define KHASH_SIZE	512
 #define KHASH_MASK	(KHASH_SIZE - 1)
+#define KHASH_INIT	2166136261UL
+#define KHASH_ADD(h, c)	(((h) ^ (long_u)(c)) * 16777619UL & 0xffffffffUL)
 #define MAXKEYWLEN	80	    /* maximum length of a keyword */
 
 /*
@@ -230,6 +274,10 @@ struct syn_cluster
  */
 static char_u **syn_cmdlinep;
 
+#ifdef SYN_TIME
+static int syn_time_on = FALSE;	    /* ":syntax time on" used */
+#endif
+
 /*
  * Another Annoying Hack(TM):  To prevent rules from higher or lower in the
  * ":syn include" stack from from leaking into ALLBUT lists, we track the
@@ -313,6 +361,74 @@ static int	current_line_id = 0;	/* unique number for current line */
 
 #define CUR_STATE(idx)	((struct state_item *)(current_state.ga_data))[idx]
 
+/*
+ * Prefilter for match and region start patterns.  For the current line the
+ * last column of every byte value is remembered, found with one pass over
+ * the line for all patterns together.  A pattern can't match at or after a
+ * column when one of the bytes of its sp_lit[] doesn't appear there, then
+ * syn_regexec() doesn't need to be called.
+ */
+static int	syn_lit_line_id = -1;	/* current_line_id for syn_lit_col[] */
+static int	syn_lit_col[256];	/* last column of each byte or -1 */
+static int	syn_lit_col_ic[256];	/* idem, for lower-cased bytes */
+
+/*
+ * Besides b_syn_states[], which is for the lines around the window, the
+ * states at the start of every SYN_CHK_DIST'th line that was parsed are kept
+ * in b_syn_chk[], sorted on line number.  These are not moved or dropped
+ * when scrolling or switching windows, thus going back to a part of the
+ * buffer that was displayed before doesn't need syncing again.
+ * When there are SYN_CHK_MAX entries, the least recently used one is
+ * dropped.  Entries with the same state stack share it.
+ * Entries below a changed line are removed in syntax_start().
+ */
+#define SYN_CHK_DIST	100
+#define SYN_CHK_MAX	1000
+
+struct syn_chkstack
+{
+    int		    cs_refcount;    /* number of entries using this */
+    int		    cs_len;	    /* number of items in cs_items[] */
+    struct buf_state cs_items[1];   /* actually longer */
+};
+
+struct syn_chkpt
+{
+    linenr_t		cp_lnum;	/* state at start of this line */
+    struct syn_chkstack	*cp_stack;	/* NULL for an empty stack */
+    short		*cp_next_list;	/* current_next_list */
+    int			cp_next_flags;	/* current_next_flags */
+    long		cp_used;	/* b_syn_chk_tick when last used */
+};
+
+/*
+ * For recently drawn lines the highlighting found by get_syntax_attr() is
+ * kept in b_syn_attr[], as runs of columns with the same group.  When the
+ * line is drawn again, e.g. when scrolling or moving the cursor, the syntax
+ * items don't need to be matched again.  The entry for a line is at index
+ * (lnum % SYN_ATTR_LINES).  Entries for a changed line and below it are
+ * dropped in syntax_start(): from b_syn_change_lnum, and from b_mod_top when
+ * b_changedtick differs from b_syn_attr_tick, which also catches changes
+ * within one line.  The group ID is kept instead of the attribute, so that
+ * changing highlighting doesn't make the entries invalid.
+ */
+#define SYN_ATTR_LINES	128
+
+struct syn_attr_run
+{
+    colnr_t	ar_col;		/* first column of the run */
+    int		ar_id;		/* current_trans_id for the column */
+};
+
+struct syn_attr_line
+{
+    linenr_t		sa_lnum;	/* line number, zero when unused */
+    int			sa_endcol;	/* last column in sa_runs[] */
+    int			sa_len;		/* number of used runs */
+    int			sa_size;	/* number of allocated runs */
+    struct syn_attr_run	*sa_runs;	/* runs, sorted on column */
+};
+
 static void syn_sync __ARGS((WIN *wp, linenr_t lnum));
 static int syn_match_linecont __ARGS((linenr_t lnum));
 static void syn_start_line __ARGS((void));
@@ -322,10 +438,26 @@ static void store_current_state __ARGS((void));
 static void invalidate_current_state __ARGS((void));
 static void validate_current_state __ARGS((void));
 static void copy_state_to_current __ARGS((struct syn_state *from));
+static void load_current_state __ARGS((struct buf_state *bs, int len, short *next_list, int next_flags));
+static int syn_chk_find __ARGS((BUF *buf, linenr_t lnum));
+static int syn_chk_same __ARGS((struct syn_chkstack *stack));
+static void syn_chk_store __ARGS((void));
+static int syn_chk_load __ARGS((linenr_t lnum, long maxdist));
+static void syn_chk_remove __ARGS((BUF *buf, int idx));
+static void syn_chk_invalidate __ARGS((BUF *buf, linenr_t lnum));
+static void syn_chk_free __ARGS((BUF *buf));
+static struct syn_attr_line *syn_attr_entry __ARGS((void));
+static int syn_attr_add __ARGS((struct syn_attr_line *sal, int id));
+static int syn_attr_lookup __ARGS((struct syn_attr_line *sal, colnr_t col));
+static void syn_attr_invalidate __ARGS((BUF *buf, linenr_t lnum));
+static void syn_attr_free __ARGS((BUF *buf));
+static int syn_attr_at __ARGS((colnr_t col, char_u *line));
 static void move_state __ARGS((int from, int to));
 static int syn_finish_line __ARGS((int syncing));
 static int syn_current_attr __ARGS((int syncing, char_u *line));
 static int did_match_already __ARGS((int idx));
+static void syn_lit_scan __ARGS((char_u *line));
+static int syn_lit_possible __ARGS((struct syn_pattern *spp, char_u *line, int col));
 static struct state_item *push_next_match __ARGS((struct state_item *cur_si, char_u *line));
 static void check_state_ends __ARGS((char_u *line));
 static void update_si_attr __ARGS((int idx));
@@ -333,7 +465,7 @@ static void check_keepend __ARGS((void));
 static void update_si_end __ARGS((struct state_item *sip, char_u *line, int startcol));
 static short *copy_id_list __ARGS((short *list));
 static int in_id_list __ARGS((short *cont_list, int id, int inclvl, int contained));
-static int syn_regexec __ARGS((vim_regexp *prog, char_u *string, int at_bol));
+static int syn_regexec __ARGS((vim_regexp *prog, char_u *string, int at_bol, struct syn_time *st));
 static int push_current __ARGS((int idx));
 static void pop_current __ARGS((void));
 static char_u *find_endp __ARGS((int idx, char_u *sstart, int at_bol, char_u **hl_endp, int *flagsp, char_u **end_endp, int *end_idx));
@@ -380,7 +512,21 @@ static int syn_check_cluster __ARGS((char_u *pp, int len));
 static int syn_add_cluster __ARGS((char_u *name));
 static void init_syn_patterns __ARGS((void));
 static char_u *get_syn_pattern __ARGS((char_u *arg, struct syn_pattern	*ci));
+static void syn_get_literal __ARGS((struct syn_pattern *spp));
+static int syn_prog_hashval __ARGS((char_u *pat));
+static vim_regexp *syn_prog_get __ARGS((char_u *pat));
+static void syn_prog_unref __ARGS((BUF *buf, vim_regexp *prog, char_u *pat));
 static void syn_cmd_sync __ARGS((EXARG *eap, int syncing));
+#ifdef SYN_TIME
+static void syn_cmd_time __ARGS((EXARG *eap, int syncing));
+static void syn_time_clear __ARGS((BUF *buf));
+# ifdef __BORLANDC__
+static int _RTLENTRYF syn_time_cmp __ARGS((const void *v1, const void *v2));
+# else
+static int syn_time_cmp __ARGS((const void *v1, const void *v2));
+# endif
+static void syn_time_report __ARGS((void));
+#endif
 static int get_id_list __ARGS((char_u **arg, int keylen, short **list));
 static void syn_combine_list __ARGS((short **clstr1, short **clstr2, int list_op));
 static void syn_incl_toplevel __ARGS((int id, int *flagsp));
@@ -426,6 +572,11 @@ syntax_start(wp, lnum)
      */
     if (syn_buf->b_syn_states_len != Rows + SYNC_LINES)
     {
+	if (syn_buf->b_syn_change_lnum != MAXLNUM)
+	{
+	    syn_chk_invalidate(syn_buf, syn_buf->b_syn_change_lnum);
+	    syn_attr_invalidate(syn_buf, syn_buf->b_syn_change_lnum);
+	}
 	syn_free_all_states(syn_buf);
 	syn_buf->b_syn_states = (struct syn_state *)alloc_clear(
 		  (int)((Rows + SYNC_LINES) * sizeof(struct syn_state)));
@@ -458,9 +609,27 @@ syntax_start(wp, lnum)
 	}
 	if (syn_buf->b_syn_change_lnum <= current_lnum)
 	    invalidate_current_state();
+	syn_chk_invalidate(syn_buf, syn_buf->b_syn_change_lnum);
+	syn_attr_invalidate(syn_buf, syn_buf->b_syn_change_lnum);
 	syn_buf->b_syn_change_lnum = MAXLNUM;
     }
 
+    /*
+     * Text was changed since b_syn_attr[] and b_syn_chk[] were filled, e.g.
+     * by typing in a line or SetBufferLine(), which don't set
+     * b_syn_change_lnum.  Drop the entries from the topmost changed line, or
+     * all of them when that isn't known anymore.
+     */
+    if (syn_buf->b_syn_attr_tick != syn_buf->b_changedtick)
+    {
+	first = syn_buf->b_mod_set ? syn_buf->b_mod_top : 1;
+	syn_attr_invalidate(syn_buf, (linenr_t)first);
+	syn_chk_invalidate(syn_buf, (linenr_t)first);
+	if (first <= current_lnum)
+	    invalidate_current_state();
+	syn_buf->b_syn_attr_tick = syn_buf->b_changedtick;
+    }
+
     /*
      * If the topline has changed out of range of b_syn_states[], move the
      * items in the array.
@@ -507,12 +676,28 @@ syntax_start(wp, lnum)
 
     /*
      * If the state of the end of the previous line is useful, store it.
+     * This is also done outside of b_syn_states[], so that going through
+     * the buffer line by line (":hardcopy", syntax folding, synID()) parses
+     * every line once, instead of going back to a saved state for every
+     * line.
      */
+    diff = syn_buf->b_syn_sync_minlines;
+    if (diff < Rows * 2)
+	diff = Rows * 2;
+    idx = lnum - syn_buf->b_syn_states_lnum;
     if (VALID_STATE(&current_state)
+	    && !current_finished
+	    && current_lnum + 1 == lnum
+	    && idx >= 0 && idx < syn_buf->b_syn_states_len
+	    && VALID_STATE(&syn_buf->b_syn_states[idx].sst_ga))
+    {
+	/* The previous line wasn't parsed to the end, e.g. because its
+	 * attributes were in b_syn_attr[], but the state for "lnum" was
+	 * saved: use that one below. */
+	invalidate_current_state();
+    }
+    else if (VALID_STATE(&current_state)
 	    && current_lnum < lnum
-	    && current_lnum >= syn_buf->b_syn_states_lnum
-	    && current_lnum <
-			syn_buf->b_syn_states_lnum + syn_buf->b_syn_states_len
 	    && current_lnum < syn_buf->b_ml.ml_line_count)
     {
 	(void)syn_finish_line(FALSE);
@@ -524,10 +709,16 @@ syntax_start(wp, lnum)
 
 	/*
 	 * If the current_lnum is now the same as "lnum", keep the current
-	 * state (this happens very often!).  Otherwise invalidate
-	 * current_state and figure it out below.
+	 * state (this happens very often!).  When "lnum" is not far below it
+	 * and outside of b_syn_states[] it is also kept, the lines in between
+	 * are parsed below.  Otherwise invalidate current_state and figure it
+	 * out below.
 	 */
-	if (current_lnum != lnum)
+	if (current_lnum != lnum
+		&& (lnum - current_lnum > diff
+		    || (lnum >= syn_buf->b_syn_states_lnum
+			&& lnum < syn_buf->b_syn_states_lnum
+						 + syn_buf->b_syn_states_len)))
 	    invalidate_current_state();
     }
     else
@@ -540,9 +731,7 @@ syntax_start(wp, lnum)
      */
     if (INVALID_STATE(&current_state))
     {
-	diff = syn_buf->b_syn_sync_minlines;
-	if (diff < Rows * 2)
-	    diff = Rows * 2;	    /* parse less then two screenfulls extra */
+	/* parse less then two screenfulls extra */
 	if (lnum >= syn_buf->b_syn_states_lnum
 		&& lnum <= syn_buf->b_syn_states_lnum +
 					     syn_buf->b_syn_states_len + diff)
@@ -562,6 +751,15 @@ syntax_start(wp, lnum)
 	}
     }
 
+    /*
+     * Try starting at a state kept for the whole buffer, if there is one not
+     * too far above "lnum".  They are SYN_CHK_DIST lines apart, allow at
+     * least that distance.
+     */
+    if (INVALID_STATE(&current_state))
+	(void)syn_chk_load(lnum, diff < SYN_CHK_DIST ? (long)SYN_CHK_DIST
+								     : diff);
+
     /*
      * If "lnum" is before or far beyond a line with a saved state, need to
      * re-synchronize.
@@ -594,6 +792,46 @@ theend:
     reg_syn = FALSE;
 }
 
+/*
+ * Called while waiting for the user to type a character: parse the lines
+ * below the current window ahead of time, so that the states in b_syn_chk[]
+ * are there when scrolling down or jumping.  Stops as soon as a character is
+ * available, continues from there the next time.
+ * The lines are done one by one, so that syntax_start() continues with the
+ * state of the previous line instead of syncing for every step.
+ * This changes the current state, syntax_start() takes care of that.
+ */
+    void
+syntax_idle()
+{
+    WIN		*wp = curwin;
+    BUF		*buf = wp->w_buffer;
+    linenr_t	lnum;
+    linenr_t	last;
+
+    /* Only when the window was displayed with syntax highlighting. */
+    if (!syntax_present(buf) || buf->b_syn_states_len == 0)
+	return;
+
+    lnum = buf->b_syn_idle_lnum;
+    if (lnum < wp->w_botline)
+	lnum = wp->w_botline;
+
+    /* Don't go so far that the entries near the window are dropped. */
+    last = wp->w_botline + (linenr_t)SYN_CHK_DIST * (SYN_CHK_MAX / 2);
+    if (last > buf->b_ml.ml_line_count)
+	last = buf->b_ml.ml_line_count;
+
+    while (lnum <= last && !ui_char_avail())
+    {
+	syntax_start(wp, lnum);
+	if (got_int)
+	    break;
+	++lnum;
+    }
+    buf->b_syn_idle_lnum = lnum;
+}
+
 /*
  * Try to find a synchronisation point for line "lnum".
  *
@@ -834,7 +1072,7 @@ syn_match_linecont(lnum)
     {
 	reg_ic = syn_buf->b_syn_linecont_ic;
 	return syn_regexec(syn_buf->b_syn_linecont_prog,
-				      ml_get_buf(syn_buf, lnum, FALSE), TRUE);
+				ml_get_buf(syn_buf, lnum, FALSE), TRUE, NULL);
     }
     return FALSE;
 }
@@ -925,6 +1163,9 @@ store_current_state()
     int			i;
     struct growarray	*to;
 
+    if (current_lnum % SYN_CHK_DIST == 0)
+	syn_chk_store();
+
     idx = current_lnum - syn_buf->b_syn_states_lnum;
     if (idx >= 0 && idx < syn_buf->b_syn_states_len)
     {
@@ -958,19 +1199,33 @@ store_current_state()
     static void
 copy_state_to_current(from)
     struct syn_state *from;
+{
+    load_current_state(SYN_STATE_P(&from->sst_ga), from->sst_ga.ga_len,
+				     from->sst_next_list, from->sst_next_flags);
+}
+
+/*
+ * Make the "len" items in "bs" the current state stack, with "next_list" and
+ * "next_flags" for the nextgroup.
+ */
+    static void
+load_current_state(bs, len, next_list, next_flags)
+    struct buf_state	*bs;
+    int			len;
+    short		*next_list;
+    int			next_flags;
 {
     int	    i;
-    struct growarray	*ga = &(from->sst_ga);
 
     ga_clear(&current_state);
     validate_current_state();
     keepend_level = -1;
-    if (ga->ga_len && ga_grow(&current_state, ga->ga_len) != FAIL)
+    if (len && ga_grow(&current_state, len) != FAIL)
     {
-	for (i = 0; i < ga->ga_len; ++i)
+	for (i = 0; i < len; ++i)
 	{
-	    CUR_STATE(i).si_idx = SYN_STATE_P(ga)[i].bs_idx;
-	    CUR_STATE(i).si_flags = SYN_STATE_P(ga)[i].bs_flags;
+	    CUR_STATE(i).si_idx = bs[i].bs_idx;
+	    CUR_STATE(i).si_flags = bs[i].bs_flags;
 	    if (keepend_level < 0 && (CUR_STATE(i).si_flags & HL_KEEPEND))
 		keepend_level = i;
 	    CUR_STATE(i).si_m_endcol = 0;
@@ -980,11 +1235,242 @@ copy_state_to_current(from)
 		       (SYN_ITEMS(syn_buf)[CUR_STATE(i).si_idx]).sp_next_list;
 	    update_si_attr(i);
 	}
-	current_state.ga_len = ga->ga_len;
+	current_state.ga_len = len;
 	current_state.ga_room -= current_state.ga_len;
     }
-    current_next_list = from->sst_next_list;
-    current_next_flags = from->sst_next_flags;
+    current_next_list = next_list;
+    current_next_flags = next_flags;
+}
+
+/*
+ * Return the index of the last entry in b_syn_chk[] of "buf" for a line at
+ * or before "lnum", -1 if there is none.
+ */
+    static int
+syn_chk_find(buf, lnum)
+    BUF		*buf;
+    linenr_t	lnum;
+{
+    int		lo = 0;
+    int		hi = buf->b_syn_chk_len;
+    int		mid;
+
+    while (lo < hi)
+    {
+	mid = (lo + hi) / 2;
+	if (buf->b_syn_chk[mid].cp_lnum <= lnum)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+/*
+ * Return TRUE if "stack" is equal to the current state stack.
+ */
+    static int
+syn_chk_same(stack)
+    struct syn_chkstack	*stack;
+{
+    int		i;
+
+    if (stack == NULL)
+	return current_state.ga_len == 0;
+    if (stack->cs_len != current_state.ga_len)
+	return FALSE;
+    for (i = 0; i < stack->cs_len; ++i)
+	if (stack->cs_items[i].bs_idx != CUR_STATE(i).si_idx
+		|| stack->cs_items[i].bs_flags != CUR_STATE(i).si_flags)
+	    return FALSE;
+    return TRUE;
+}
+
+/*
+ * Store the current state, for the start of current_lnum, in b_syn_chk[].
+ */
+    static void
+syn_chk_store()
+{
+    BUF			*buf = syn_buf;
+    int			idx;
+    int			i;
+    struct syn_chkpt	*cp;
+    struct syn_chkstack	*stack = NULL;
+
+    idx = syn_chk_find(buf, current_lnum);
+    if (idx >= 0 && buf->b_syn_chk[idx].cp_lnum == current_lnum)
+    {
+	/* Already there, only need to update when different. */
+	cp = &buf->b_syn_chk[idx];
+	cp->cp_used = ++buf->b_syn_chk_tick;
+	if (syn_chk_same(cp->cp_stack)
+		&& cp->cp_next_list == current_next_list
+		&& cp->cp_next_flags == current_next_flags)
+	    return;
+	syn_chk_remove(buf, idx);
+	--idx;
+    }
+
+    /* Share the stack with a neighbour when it's the same. */
+    if (current_state.ga_len > 0)
+    {
+	if (idx >= 0 && buf->b_syn_chk[idx].cp_stack != NULL
+			       && syn_chk_same(buf->b_syn_chk[idx].cp_stack))
+	    stack = buf->b_syn_chk[idx].cp_stack;
+	else if (idx + 1 < buf->b_syn_chk_len
+		&& buf->b_syn_chk[idx + 1].cp_stack != NULL
+			   && syn_chk_same(buf->b_syn_chk[idx + 1].cp_stack))
+	    stack = buf->b_syn_chk[idx + 1].cp_stack;
+	else
+	{
+	    stack = (struct syn_chkstack *)alloc((unsigned)(
+			   sizeof(struct syn_chkstack) + sizeof(struct buf_state)
+					       * (current_state.ga_len - 1)));
+	    if (stack == NULL)
+		return;
+	    stack->cs_refcount = 0;
+	    stack->cs_len = current_state.ga_len;
+	    for (i = 0; i < current_state.ga_len; ++i)
+	    {
+		stack->cs_items[i].bs_idx = CUR_STATE(i).si_idx;
+		stack->cs_items[i].bs_flags = CUR_STATE(i).si_flags;
+	    }
+	}
+	++stack->cs_refcount;
+    }
+
+    /* Drop the least recently used entry when the store is full. */
+    if (buf->b_syn_chk_len >= SYN_CHK_MAX)
+    {
+	int	lru = 0;
+
+	for (i = 1; i < buf->b_syn_chk_len; ++i)
+	    if (buf->b_syn_chk[i].cp_used < buf->b_syn_chk[lru].cp_used)
+		lru = i;
+	/* "stack" may be shared with the dropped entry, it has a reference
+	 * already */
+	syn_chk_remove(buf, lru);
+	if (lru <= idx)
+	    --idx;
+    }
+
+    if (buf->b_syn_chk_len >= buf->b_syn_chk_size)
+    {
+	int		    newsize;
+	struct syn_chkpt    *newchk;
+
+	newsize = buf->b_syn_chk_size == 0 ? 50 : buf->b_syn_chk_size * 2;
+	if (newsize > SYN_CHK_MAX)
+	    newsize = SYN_CHK_MAX;
+	newchk = (struct syn_chkpt *)alloc(
+				(unsigned)(newsize * sizeof(struct syn_chkpt)));
+	if (newchk == NULL)
+	{
+	    if (stack != NULL && --stack->cs_refcount == 0)
+		vim_free(stack);
+	    return;
+	}
+	if (buf->b_syn_chk != NULL)
+	    mch_memmove(newchk, buf->b_syn_chk,
+			   (size_t)(buf->b_syn_chk_len * sizeof(struct syn_chkpt)));
+	vim_free(buf->b_syn_chk);
+	buf->b_syn_chk = newchk;
+	buf->b_syn_chk_size = newsize;
+    }
+
+    /* insert after entry "idx" */
+    ++idx;
+    if (idx < buf->b_syn_chk_len)
+	mch_memmove(&buf->b_syn_chk[idx + 1], &buf->b_syn_chk[idx],
+		 (size_t)((buf->b_syn_chk_len - idx) * sizeof(struct syn_chkpt)));
+    ++buf->b_syn_chk_len;
+    cp = &buf->b_syn_chk[idx];
+    cp->cp_lnum = current_lnum;
+    cp->cp_stack = stack;
+    cp->cp_next_list = current_next_list;
+    cp->cp_next_flags = current_next_flags;
+    cp->cp_used = ++buf->b_syn_chk_tick;
+}
+
+/*
+ * Set the current state from the entry in b_syn_chk[] nearest above "lnum",
+ * if it is not more than "maxdist" lines above it.
+ * Returns FAIL when there is no such entry.
+ */
+    static int
+syn_chk_load(lnum, maxdist)
+    linenr_t	lnum;
+    long	maxdist;
+{
+    int			idx;
+    struct syn_chkpt	*cp;
+
+    idx = syn_chk_find(syn_buf, lnum);
+    if (idx < 0)
+	return FAIL;
+    cp = &syn_buf->b_syn_chk[idx];
+    if (lnum - cp->cp_lnum > maxdist)
+	return FAIL;
+    if (cp->cp_stack == NULL)
+	load_current_state(NULL, 0, cp->cp_next_list, cp->cp_next_flags);
+    else
+	load_current_state(cp->cp_stack->cs_items, cp->cp_stack->cs_len,
+					 cp->cp_next_list, cp->cp_next_flags);
+    current_lnum = cp->cp_lnum;
+    cp->cp_used = ++syn_buf->b_syn_chk_tick;
+    return OK;
+}
+
+/*
+ * Remove entry "idx" from b_syn_chk[] of "buf".
+ */
+    static void
+syn_chk_remove(buf, idx)
+    BUF		*buf;
+    int		idx;
+{
+    struct syn_chkstack	*stack = buf->b_syn_chk[idx].cp_stack;
+
+    if (stack != NULL && --stack->cs_refcount == 0)
+	vim_free(stack);
+    --buf->b_syn_chk_len;
+    if (idx < buf->b_syn_chk_len)
+	mch_memmove(&buf->b_syn_chk[idx], &buf->b_syn_chk[idx + 1],
+		 (size_t)((buf->b_syn_chk_len - idx) * sizeof(struct syn_chkpt)));
+}
+
+/*
+ * Remove the entries from b_syn_chk[] of "buf" that may have become invalid
+ * by a change in line "lnum": the ones for lines below it.
+ */
+    static void
+syn_chk_invalidate(buf, lnum)
+    BUF		*buf;
+    linenr_t	lnum;
+{
+    int		idx;
+
+    idx = syn_chk_find(buf, lnum);
+    while (buf->b_syn_chk_len > idx + 1)
+	syn_chk_remove(buf, buf->b_syn_chk_len - 1);
+    if (buf->b_syn_idle_lnum > lnum)
+	buf->b_syn_idle_lnum = lnum;
+}
+
+/*
+ * Free b_syn_chk[] for buffer "buf".
+ */
+    static void
+syn_chk_free(buf)
+    BUF		*buf;
+{
+    while (buf->b_syn_chk_len > 0)
+	syn_chk_remove(buf, buf->b_syn_chk_len - 1);
+    vim_free(buf->b_syn_chk);
+    buf->b_syn_chk = NULL;
+    buf->b_syn_chk_size = 0;
+    buf->b_syn_idle_lnum = 0;
 }
 
     static void
@@ -1160,22 +1646,63 @@ get_syntax_attr(col, line)
     colnr_t	col;
     char_u	*line;
 {
-    int	    attr = 0;
-
-    reg_syn = TRUE;	/* let vim_regexec() know we're using syntax */
+    struct syn_attr_line    *sal;
+    int			    attr = 0;
 
     /* check for out of memory situation */
     if (syn_buf->b_syn_states_len == 0)
 	return 0;
 
+    /* Use the attributes found when the line was drawn before. */
+    sal = syn_attr_entry();
+    if (sal != NULL && (int)col <= sal->sa_endcol)
+	return syn_attr_lookup(sal, col);
+
+    reg_syn = TRUE;	/* let vim_regexec() know we're using syntax */
+
     /* Make sure current_state is valid */
     if (INVALID_STATE(&current_state))
 	validate_current_state();
 
     /*
      * Skip from the current column to "col", get the attributes for "col".
+     * Remember them for columns not in b_syn_attr[] yet.
      */
     while (current_col <= col)
+    {
+	attr = syn_current_attr(FALSE, line);
+	if (sal != NULL && (int)current_col == sal->sa_endcol + 1
+				   && syn_attr_add(sal, current_trans_id) == FAIL)
+	    sal = NULL;
+	++current_col;
+    }
+
+    reg_syn = FALSE;
+    return attr;
+}
+
+/*
+ * Get attributes for column "col" of the current line, without using or
+ * filling b_syn_attr[].  Sets current_id and current_trans_id.
+ */
+    static int
+syn_attr_at(col, line)
+    colnr_t	col;
+    char_u	*line;
+{
+    int	    attr = 0;
+
+    reg_syn = TRUE;	/* let vim_regexec() know we're using syntax */
+
+    /* check for out of memory situation */
+    if (syn_buf->b_syn_states_len == 0)
+	return 0;
+
+    /* Make sure current_state is valid */
+    if (INVALID_STATE(&current_state))
+	validate_current_state();
+
+    while (current_col <= col)
     {
 	attr = syn_current_attr(FALSE, line);
 	++current_col;
@@ -1185,6 +1712,133 @@ get_syntax_attr(col, line)
     return attr;
 }
 
+/*
+ * Get the b_syn_attr[] entry for current_lnum.  When the entry is used for
+ * another line and the current line wasn't parsed yet, it's cleared for
+ * current_lnum.
+ * Returns NULL when there is no usable entry.
+ */
+    static struct syn_attr_line *
+syn_attr_entry()
+{
+    struct syn_attr_line    *sal;
+
+    if (syn_buf->b_syn_attr == NULL)
+    {
+	syn_buf->b_syn_attr = (struct syn_attr_line *)alloc_clear(
+			  (unsigned)(SYN_ATTR_LINES * sizeof(struct syn_attr_line)));
+	if (syn_buf->b_syn_attr == NULL)
+	    return NULL;
+	syn_buf->b_syn_attr_tick = syn_buf->b_changedtick;
+    }
+    sal = &syn_buf->b_syn_attr[current_lnum % SYN_ATTR_LINES];
+    if (sal->sa_lnum != current_lnum)
+    {
+	if (current_col != 0)
+	    return NULL;
+	sal->sa_lnum = current_lnum;
+	sal->sa_endcol = -1;
+	sal->sa_len = 0;
+    }
+    return sal;
+}
+
+/*
+ * Add the next column with syntax ID "id" to "sal".
+ * Returns FAIL when out of memory, the entry is cleared then.
+ */
+    static int
+syn_attr_add(sal, id)
+    struct syn_attr_line    *sal;
+    int			    id;
+{
+    struct syn_attr_run	    *runs;
+
+    ++sal->sa_endcol;
+    if (sal->sa_len > 0 && sal->sa_runs[sal->sa_len - 1].ar_id == id)
+	return OK;
+    if (sal->sa_len == sal->sa_size)
+    {
+	runs = (struct syn_attr_run *)alloc((unsigned)(
+		   (sal->sa_size + 10) * 2 * sizeof(struct syn_attr_run)));
+	if (runs == NULL)
+	{
+	    sal->sa_lnum = 0;
+	    return FAIL;
+	}
+	if (sal->sa_runs != NULL)
+	    mch_memmove(runs, sal->sa_runs,
+			     (size_t)(sal->sa_len * sizeof(struct syn_attr_run)));
+	vim_free(sal->sa_runs);
+	sal->sa_runs = runs;
+	sal->sa_size = (sal->sa_size + 10) * 2;
+    }
+    sal->sa_runs[sal->sa_len].ar_col = sal->sa_endcol;
+    sal->sa_runs[sal->sa_len].ar_id = id;
+    ++sal->sa_len;
+    return OK;
+}
+
+/*
+ * Return the attributes for column "col" from "sal".
+ */
+    static int
+syn_attr_lookup(sal, col)
+    struct syn_attr_line    *sal;
+    colnr_t		    col;
+{
+    int		lo, hi, mid;
+
+    /* binary search for the last run that starts at or before "col" */
+    lo = 0;
+    hi = sal->sa_len - 1;
+    while (lo < hi)
+    {
+	mid = (lo + hi + 1) / 2;
+	if (sal->sa_runs[mid].ar_col <= col)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    if (sal->sa_runs[lo].ar_id == 0)
+	return 0;
+    return syn_id2attr(sal->sa_runs[lo].ar_id);
+}
+
+/*
+ * Remove the b_syn_attr[] entries for "lnum" and below.
+ */
+    static void
+syn_attr_invalidate(buf, lnum)
+    BUF		*buf;
+    linenr_t	lnum;
+{
+    int		i;
+
+    if (buf->b_syn_attr != NULL)
+	for (i = 0; i < SYN_ATTR_LINES; ++i)
+	    if (buf->b_syn_attr[i].sa_lnum >= lnum)
+		buf->b_syn_attr[i].sa_lnum = 0;
+}
+
+/*
+ * Free b_syn_attr[] for buffer "buf".
+ */
+    static void
+syn_attr_free(buf)
+    BUF		*buf;
+{
+    int		i;
+
+    if (buf->b_syn_attr != NULL)
+    {
+	for (i = 0; i < SYN_ATTR_LINES; ++i)
+	    vim_free(buf->b_syn_attr[i].sa_runs);
+	vim_free(buf->b_syn_attr);
+	buf->b_syn_attr = NULL;
+    }
+}
+
 /*
  * Get syntax attributes for current_lnum, current_col.
  */
@@ -1372,8 +2026,9 @@ syn_current_attr(syncing, line)
 				lc_col = 0;
 
 			    reg_ic = spp->sp_ic;
-			    if (!syn_regexec(spp->sp_prog, line + lc_col,
-					     lc_col == 0))
+			    if (!syn_lit_possible(spp, line, lc_col)
+				    || !syn_regexec(spp->sp_prog, line + lc_col,
+						lc_col == 0, &spp->sp_time))
 			    {
 				spp->sp_startcol = MAXCOL;
 				continue;
@@ -1580,6 +2235,53 @@ did_match_already(idx)
     return FALSE;
 }
 
+/*
+ * Remember the last column of every byte in "line", for syn_lit_possible().
+ */
+    static void
+syn_lit_scan(line)
+    char_u	*line;
+{
+    int		i;
+    int		c;
+
+    for (i = 0; i < 256; ++i)
+    {
+	syn_lit_col[i] = -1;
+	syn_lit_col_ic[i] = -1;
+    }
+    for (i = 0; (c = line[i]) != NUL; ++i)
+    {
+	syn_lit_col[c] = i;
+	syn_lit_col_ic[TO_LOWER(c)] = i;
+    }
+    syn_lit_line_id = current_line_id;
+}
+
+/*
+ * Return FALSE when pattern "spp" can't match in "line" at or after column
+ * "col", because a byte of its required literal doesn't appear there.
+ */
+    static int
+syn_lit_possible(spp, line, col)
+    struct syn_pattern	*spp;
+    char_u		*line;
+    int			col;
+{
+    char_u	*p;
+    int		*tab;
+
+    if (spp->sp_lit[0] == NUL)
+	return TRUE;
+    if (syn_lit_line_id != current_line_id)
+	syn_lit_scan(line);
+    tab = spp->sp_lit_ic ? syn_lit_col_ic : syn_lit_col;
+    for (p = spp->sp_lit; *p != NUL; ++p)
+	if (tab[*p] < col)
+	    return FALSE;
+    return TRUE;
+}
+
 /*
  * Push the next match onto the stack.
  */
@@ -1958,7 +2660,8 @@ find_endp(idx, sstart, at_bol, hl_endp, flagsp, end_endp, end_idx)
 		break;
 
 	    reg_ic = spp->sp_ic;
-	    if (syn_regexec(spp->sp_prog, endp, (at_bol && endp == sstart)))
+	    if (syn_regexec(spp->sp_prog, endp, (at_bol && endp == sstart),
+							     &spp->sp_time))
 	    {
 		if (best_idx == -1 || spp->sp_prog->startp[0] < best_ptr)
 		{
@@ -1982,7 +2685,7 @@ find_endp(idx, sstart, at_bol, hl_endp, flagsp, end_endp, end_idx)
 	if (	   spp_skip != NULL
 		&& (reg_ic = spp_skip->sp_ic,
 			syn_regexec(spp_skip->sp_prog, endp,
-						  (at_bol && endp == sstart)))
+			       (at_bol && endp == sstart), &spp_skip->sp_time))
 		&& spp_skip->sp_prog->startp[0] <= best_ptr)
 	{
 	    /* Add offset to skip pattern match */
@@ -2094,49 +2797,52 @@ check_keyword_id(line, startcol, endcol, flags, next_list, cur_si)
     struct keyentry *ktab;
     char_u	    *p;
     int		    round;
-    int		    hash;
+    long_u	    hash = KHASH_INIT;
+    long_u	    hash_ic = KHASH_INIT;
+    int		    do_ic = (syn_buf->b_keywtab_ic != NULL);
     int		    len;
     char_u	    keyword[MAXKEYWLEN + 1]; /* assume max. keyword len is 80 */
 
-    /* Find first character after the keyword */
-    p = line + startcol;
-    for (len = 1; vim_iswordc_buf(p[len], syn_buf); ++len)
-	;
-    if (len > MAXKEYWLEN)
-	return 0;
-
     /*
-     * Must make a copy of the keyword, so we can add a NUL and make it
-     * lowercase.
+     * Find the end of the keyword.  At the same time compute the hash and,
+     * when there are ignore-case keywords, make a lowercase copy and compute
+     * its hash.
      */
-    STRNCPY(keyword, p, len);
+    p = line + startcol;
+    len = 0;
+    do
+    {
+	if (len == MAXKEYWLEN)
+	    return 0;
+	hash = KHASH_ADD(hash, p[len]);
+	if (do_ic)
+	{
+	    keyword[len] = TO_LOWER(p[len]);
+	    hash_ic = KHASH_ADD(hash_ic, keyword[len]);
+	}
+	++len;
+    } while (vim_iswordc_buf(p[len], syn_buf));
     keyword[len] = NUL;
 
     /*
      * Try twice:
-     * 1. matching case
-     * 2. ignoring case
+     * 1. matching case, compare with the text in the line
+     * 2. ignoring case, compare with the lowercase copy
      */
     for (round = 1; round <= 2; ++round)
     {
-	if ((round == 1 ? syn_buf->b_keywtab : syn_buf->b_keywtab_ic) == NULL)
-	    continue;
-	p = keyword;
-	hash = 0;
-	if (round == 1)	/* match case */
+	if (round == 1)
 	{
-	    while (*p)
-		hash += *p++;
+	    if (syn_buf->b_keywtab == NULL)
+		continue;
 	    ktab = syn_buf->b_keywtab[hash & KHASH_MASK];
 	}
-	else /* round == 2, ignore case */
+	else
 	{
-	    while (*p)
-	    {
-		hash += (*p = TO_LOWER(*p));
-		++p;
-	    }
-	    ktab = syn_buf->b_keywtab_ic[hash & KHASH_MASK];
+	    if (!do_ic)
+		continue;
+	    ktab = syn_buf->b_keywtab_ic[hash_ic & KHASH_MASK];
+	    p = keyword;
 	}
 
 	/*
@@ -2146,7 +2852,9 @@ check_keyword_id(line, startcol, endcol, flags, next_list, cur_si)
 	 *  Accept a keyword at other levels only if it is in the contains list.
 	 */
 	for ( ; ktab != NULL; ktab = ktab->next)
-	    if (   STRCMP(keyword, ktab->keyword) == 0
+	    if (   ktab->keyword[0] == p[0]
+		&& STRNCMP(ktab->keyword, p, len) == 0
+		&& ktab->keyword[len] == NUL
 		&& (   (current_next_list != 0
 			&& in_id_list(current_next_list, ktab->syn_id,
 				      ktab->syn_inc_lvl, 0))
@@ -2230,6 +2938,8 @@ syntax_clear(buf)
 
     /* free the stored states */
     syn_free_all_states(buf);
+    syn_chk_free(buf);
+    syn_attr_free(buf);
     invalidate_current_state();
 }
 
@@ -2283,8 +2993,9 @@ syn_clear_pattern(buf, i)
     BUF	    *buf;
     int	    i;
 {
+    syn_prog_unref(buf, SYN_ITEMS(buf)[i].sp_prog,
+					       SYN_ITEMS(buf)[i].sp_pattern);
     vim_free(SYN_ITEMS(buf)[i].sp_pattern);
-    vim_free(SYN_ITEMS(buf)[i].sp_prog);
     /* Only free sp_cont_list and sp_next_list of first start pattern */
     if (i == 0 || SYN_ITEMS(buf)[i - 1].sp_type != SPTYPE_START)
     {
@@ -2992,7 +3703,7 @@ add_keyword(name, id, flags, next_list)
     struct keyentry	*ktab;
     struct keyentry	***ktabpp;
     char_u		*p;
-    int			hash;
+    long_u		hash;
 
     ktab = (struct keyentry *)alloc(
 			       (int)(sizeof(struct keyentry) + STRLEN(name)));
@@ -3021,9 +3732,9 @@ add_keyword(name, id, flags, next_list)
 	    return;
     }
 
-    hash = 0;
+    hash = KHASH_INIT;
     for (p = ktab->keyword; *p; ++p)
-	hash += *p;
+	hash = KHASH_ADD(hash, *p);
     hash &= KHASH_MASK;
 
     ktab->next = (*ktabpp)[hash];
@@ -3435,7 +4146,7 @@ syn_cmd_match(eap, syncing)
     /*
      * Something failed, free the allocated memory.
      */
-    vim_free(item.sp_prog);
+    syn_prog_unref(curbuf, item.sp_prog, item.sp_pattern);
     vim_free(item.sp_pattern);
     vim_free(cont_list);
     vim_free(next_list);
@@ -3664,7 +4375,8 @@ syn_cmd_region(eap, syncing)
 	{
 	    if (!success)
 	    {
-		vim_free(ppp->pp_synp->sp_prog);
+		syn_prog_unref(curbuf, ppp->pp_synp->sp_prog,
+						     ppp->pp_synp->sp_pattern);
 		vim_free(ppp->pp_synp->sp_pattern);
 	    }
 	    vim_free(ppp->pp_synp);
@@ -4033,7 +4745,6 @@ get_syn_pattern(arg, ci)
     char_u	*end;
     int		*p;
     int		idx;
-    char_u	*cpo_save;
 
     /* need at least three chars */
     if (arg == NULL || arg[1] == NUL || arg[2] == NUL)
@@ -4049,15 +4760,11 @@ get_syn_pattern(arg, ci)
     if ((ci->sp_pattern = vim_strnsave(arg + 1, (int)(end - arg - 1))) == NULL)
 	return NULL;
 
-    /* Make 'cpoptions' empty, to avoid the 'l' flag */
-    cpo_save = p_cpo;
-    p_cpo = (char_u *)"";
-    ci->sp_prog = vim_regcomp(ci->sp_pattern, TRUE);
-    p_cpo = cpo_save;
-
+    ci->sp_prog = syn_prog_get(ci->sp_pattern);
     if (ci->sp_prog == NULL)
 	return NULL;
     ci->sp_ic = curbuf->b_syn_ic;
+    syn_get_literal(ci);
 
     /*
      * Check for a match, highlight or region offset.
@@ -4123,6 +4830,240 @@ get_syn_pattern(arg, ci)
     return skipwhite(end);
 }
 
+/*
+ * Hash function for syn_prog_hash[].
+ */
+    static int
+syn_prog_hashval(pat)
+    char_u	*pat;
+{
+    long_u	hash = KHASH_INIT;
+
+    while (*pat != NUL)
+	hash = KHASH_ADD(hash, *pat++);
+    return (int)(hash & (SYN_PROG_HASH - 1));
+}
+
+/*
+ * Get a compiled program for pattern "pat", to be used by curbuf.  Uses a
+ * program that other buffers already compiled, if curbuf doesn't use it yet.
+ * Returns NULL when the pattern is invalid or out of memory.
+ */
+    static vim_regexp *
+syn_prog_get(pat)
+    char_u	*pat;
+{
+    struct syn_progent	*pe;
+    vim_regexp		*prog;
+    char_u		*cpo_save;
+    int			hash;
+    int			i;
+
+    hash = syn_prog_hashval(pat);
+    for (pe = syn_prog_hash[hash]; pe != NULL; pe = pe->pe_next)
+    {
+	if (STRCMP(pe->pe_pattern, pat) != 0)
+	    continue;
+	for (i = 0; i < pe->pe_users.ga_len; ++i)
+	    if (((BUF **)pe->pe_users.ga_data)[i] == curbuf)
+		break;
+	if (i == pe->pe_users.ga_len && ga_grow(&pe->pe_users, 1) == OK)
+	{
+	    ((BUF **)pe->pe_users.ga_data)[pe->pe_users.ga_len++] = curbuf;
+	    --pe->pe_users.ga_room;
+	    return pe->pe_prog;
+	}
+    }
+
+    /* Make 'cpoptions' empty, to avoid the 'l' flag */
+    cpo_save = p_cpo;
+    p_cpo = (char_u *)"";
+    prog = vim_regcomp(pat, TRUE);
+    p_cpo = cpo_save;
+    if (prog == NULL)
+	return NULL;
+
+    /* When out of memory the program is just not shared. */
+    pe = (struct syn_progent *)alloc((unsigned)(sizeof(struct syn_progent)
+							     + STRLEN(pat)));
+    if (pe != NULL)
+    {
+	ga_init(&pe->pe_users);
+	pe->pe_users.ga_itemsize = sizeof(BUF *);
+	pe->pe_users.ga_growsize = 4;
+	if (ga_grow(&pe->pe_users, 1) == FAIL)
+	{
+	    vim_free(pe);
+	    return prog;
+	}
+	((BUF **)pe->pe_users.ga_data)[pe->pe_users.ga_len++] = curbuf;
+	--pe->pe_users.ga_room;
+	pe->pe_prog = prog;
+	STRCPY(pe->pe_pattern, pat);
+	pe->pe_next = syn_prog_hash[hash];
+	syn_prog_hash[hash] = pe;
+    }
+    return prog;
+}
+
+/*
+ * Stop using program "prog" for pattern "pat" in buffer "buf".  Frees it
+ * when no other buffer uses it.
+ */
+    static void
+syn_prog_unref(buf, prog, pat)
+    BUF		*buf;
+    vim_regexp	*prog;
+    char_u	*pat;
+{
+    struct syn_progent	**pep;
+    struct syn_progent	*pe;
+    BUF			**users;
+    int			i;
+
+    if (prog == NULL)
+	return;
+    for (pep = &syn_prog_hash[syn_prog_hashval(pat)]; *pep != NULL;
+						     pep = &(*pep)->pe_next)
+	if ((*pep)->pe_prog == prog)
+	    break;
+    pe = *pep;
+    if (pe == NULL)		/* wasn't shared */
+    {
+	vim_free(prog);
+	return;
+    }
+
+    users = (BUF **)pe->pe_users.ga_data;
+    for (i = 0; i < pe->pe_users.ga_len; ++i)
+	if (users[i] == buf)
+	{
+	    users[i] = users[--pe->pe_users.ga_len];
+	    ++pe->pe_users.ga_room;
+	    break;
+	}
+    if (pe->pe_users.ga_len == 0)
+    {
+	*pep = pe->pe_next;
+	ga_clear(&pe->pe_users);
+	vim_free(pe->pe_prog);
+	vim_free(pe);
+    }
+}
+
+/*
+ * Find a string that every match of the pattern of "spp" must contain and
+ * store (the start of) it in spp->sp_lit[].  This is the longest run of
+ * literal characters before the first "\(".  Nothing is stored when the
+ * pattern contains a "\|".  When matching ignores case the string is made
+ * lower case.
+ */
+    static void
+syn_get_literal(spp)
+    struct syn_pattern	*spp;
+{
+    char_u	*p;
+    char_u	run[SYN_LIT_LEN];
+    int		runlen = 0;
+    int		bestlen = 0;
+    int		c;
+    int		i;
+
+    spp->sp_lit[0] = NUL;
+    spp->sp_lit_ic = spp->sp_ic;
+
+    /* Give up for alternatives, "\c" makes the pattern ignore case. */
+    for (p = spp->sp_pattern; *p != NUL; ++p)
+	if (*p == '\\')
+	{
+	    if (p[1] == '|')
+		return;
+	    if (p[1] == 'c')
+		spp->sp_lit_ic = TRUE;
+	    if (p[1] == NUL)
+		break;
+	    ++p;
+	}
+
+    p = spp->sp_pattern;
+    if (*p == '^')
+	++p;
+    while (*p != NUL)
+    {
+	c = -1;			/* not a literal character */
+	if (*p == '\\')
+	{
+	    if (p[1] == '(' || p[1] == 'z' || p[1] == '%' || p[1] == '@')
+		break;		/* only look at what comes before a group */
+	    if (p[1] == '{')	/* skip over "\{n,m}" */
+	    {
+		p = vim_strchr(p, '}');
+		if (p == NULL)
+		    break;
+		++p;
+	    }
+	    else if (p[1] != NUL && vim_strchr((char_u *)"\\/.*[~^$", p[1])
+								       != NULL)
+	    {
+		c = p[1];
+		p += 2;
+	    }
+	    else
+		p += (p[1] == NUL) ? 1 : 2;
+	}
+	else if (*p == '[')	/* skip over "[abc]" */
+	{
+	    ++p;
+	    if (*p == '^')
+		++p;
+	    if (*p == ']')
+		++p;
+	    while (*p != NUL && *p != ']')
+	    {
+		if (*p == '\\' && p[1] != NUL)
+		    ++p;
+		++p;
+	    }
+	    if (*p == ']')
+		++p;
+	}
+	else if (vim_strchr((char_u *)".~*$", *p) != NULL || *p >= 0x80)
+	    ++p;
+	else
+	    c = *p++;
+
+	/* A character followed by a multi is not required. */
+	if (c >= 0 && (*p == '*' || (*p == '\\'
+				   && vim_strchr((char_u *)"=+?{", p[1]) != NULL
+				   && p[1] != NUL)))
+	    c = -1;
+
+	if (c >= 0)
+	{
+	    if (runlen < SYN_LIT_LEN - 1)
+		run[runlen++] = c;
+	}
+	else
+	{
+	    if (runlen > bestlen)
+	    {
+		bestlen = runlen;
+		mch_memmove(spp->sp_lit, run, (size_t)runlen);
+	    }
+	    runlen = 0;
+	}
+    }
+    if (runlen > bestlen)
+    {
+	bestlen = runlen;
+	mch_memmove(spp->sp_lit, run, (size_t)runlen);
+    }
+    spp->sp_lit[bestlen] = NUL;
+    if (spp->sp_lit_ic)
+	for (i = 0; i < bestlen; ++i)
+	    spp->sp_lit[i] = TO_LOWER(spp->sp_lit[i]);
+}
+
 /*
  * Handle ":syntax sync .." command.
  */
@@ -4259,6 +5200,124 @@ syn_cmd_sync(eap, syncing)
     }
 }
 
+#ifdef SYN_TIME
+/*
+ * Handle ":syntax time {on,off,clear,report}".
+ */
+/* ARGSUSED */
+    static void
+syn_cmd_time(eap, syncing)
+    EXARG	*eap;
+    int		syncing;	    /* not used */
+{
+    char_u	*arg = eap->arg;
+    char_u	*next;
+
+    eap->nextcmd = find_nextcmd(arg);
+    if (eap->skip)
+	return;
+
+    next = skiptowhite(arg);
+    if (STRNICMP(arg, "on", 2) == 0 && next - arg == 2)
+	syn_time_on = TRUE;
+    else if (STRNICMP(arg, "off", 3) == 0 && next - arg == 3)
+	syn_time_on = FALSE;
+    else if (STRNICMP(arg, "clear", 5) == 0 && next - arg == 5)
+	syn_time_clear(curbuf);
+    else if (STRNICMP(arg, "report", 6) == 0 && next - arg == 6)
+	syn_time_report();
+    else
+	EMSG2("Illegal argument: %s", arg);
+}
+
+/*
+ * Clear the ":syntax time" counters of all patterns in buffer "buf".
+ */
+    static void
+syn_time_clear(buf)
+    BUF		*buf;
+{
+    int		idx;
+
+    for (idx = 0; idx < buf->b_syn_patterns.ga_len; ++idx)
+	vim_memset(&SYN_ITEMS(buf)[idx].sp_time, 0, sizeof(struct syn_time));
+}
+
+/*
+ * Compare function for qsort() in syn_time_report(): the pattern that took
+ * the most time comes first.
+ */
+    static int
+#ifdef __BORLANDC__
+_RTLENTRYF
+#endif
+syn_time_cmp(v1, v2)
+    const void	*v1;
+    const void	*v2;
+{
+    long	t1 = (*(struct syn_pattern **)v1)->sp_time.st_total;
+    long	t2 = (*(struct syn_pattern **)v2)->sp_time.st_total;
+
+    return (t1 < t2 ? 1 : t1 > t2 ? -1 : 0);
+}
+
+/*
+ * List the patterns of the current buffer that were tried, the slowest
+ * first.
+ */
+    static void
+syn_time_report()
+{
+    struct syn_pattern	**list;
+    struct syn_pattern	*spp;
+    int			len = 0;
+    int			idx;
+    long		total = 0;
+    long		count = 0;
+    char		buf[80];
+
+    list = (struct syn_pattern **)alloc((unsigned)(
+		 (curbuf->b_syn_patterns.ga_len + 1) * sizeof(*list)));
+    if (list == NULL)
+	return;
+    for (idx = 0; idx < curbuf->b_syn_patterns.ga_len; ++idx)
+    {
+	spp = &SYN_ITEMS(curbuf)[idx];
+	if (spp->sp_time.st_count > 0)
+	{
+	    list[len++] = spp;
+	    total += spp->sp_time.st_total;
+	    count += spp->sp_time.st_count;
+	}
+    }
+    qsort(list, (size_t)len, sizeof(*list), syn_time_cmp);
+
+    MSG_PUTS_TITLE("\n  TOTAL      COUNT  MATCH   SLOWEST     NAME               PATTERN");
+    for (idx = 0; idx < len && !got_int; ++idx)
+    {
+	spp = list[idx];
+	msg_putchar('\n');
+	sprintf(buf, "%3ld.%06ld %7ld %6ld %3ld.%06ld  ",
+		spp->sp_time.st_total / 1000000L,
+		spp->sp_time.st_total % 1000000L,
+		spp->sp_time.st_count,
+		spp->sp_time.st_match,
+		spp->sp_time.st_slowest / 1000000L,
+		spp->sp_time.st_slowest % 1000000L);
+	msg_puts((char_u *)buf);
+	msg_outtrans(HL_TABLE()[spp->sp_syn_id - 1].sg_name);
+	msg_advance(52);
+	msg_outtrans(spp->sp_pattern);
+	ui_breakcheck();
+    }
+    msg_putchar('\n');
+    sprintf(buf, "%3ld.%06ld %7ld", total / 1000000L, total % 1000000L,
+									count);
+    msg_puts((char_u *)buf);
+    vim_free(list);
+}
+#endif
+
 /*
  * Convert a line of highlight group names into a list of group ID numbers.
  * "arg" should point to the "contains" or "nextgroup" keyword.
@@ -4534,24 +5593,34 @@ struct subcommand
 {
     char    *name;				/* subcommand name */
     void    (*func)__ARGS((EXARG *, int));	/* function to call */
+    int	    changes;				/* see below */
 };
 
+/* values for "changes": what the subcommand does to the items, the sync
+ * settings and the case, which the kept states depend on */
+#define SYNCMD_LIST	0	/* nothing, only lists */
+#define SYNCMD_CHANGE	1	/* changes them */
+#define SYNCMD_ARG	2	/* changes them, lists without an argument */
+
 static struct subcommand subcommands[] =
 {
-    {"case",		syn_cmd_case},
-    {"clear",		syn_cmd_clear},
-    {"cluster",		syn_cmd_cluster},
-    {"include",		syn_cmd_include},
-    {"keyword",		syn_cmd_keyword},
-    {"list",		syn_cmd_list},
-    {"manual",		syn_cmd_manual},
-    {"match",		syn_cmd_match},
-    {"on",		syn_cmd_on},
-    {"off",		syn_cmd_off},
-    {"region",		syn_cmd_region},
-    {"sync",		syn_cmd_sync},
-    {"",		syn_cmd_list},
-    {NULL, NULL}
+    {"case",		syn_cmd_case,		SYNCMD_ARG},
+    {"clear",		syn_cmd_clear,		SYNCMD_CHANGE},
+    {"cluster",		syn_cmd_cluster,	SYNCMD_CHANGE},
+    {"include",		syn_cmd_include,	SYNCMD_CHANGE},
+    {"keyword",		syn_cmd_keyword,	SYNCMD_CHANGE},
+    {"list",		syn_cmd_list,		SYNCMD_LIST},
+    {"manual",		syn_cmd_manual,		SYNCMD_CHANGE},
+    {"match",		syn_cmd_match,		SYNCMD_CHANGE},
+    {"on",		syn_cmd_on,		SYNCMD_CHANGE},
+    {"off",		syn_cmd_off,		SYNCMD_CHANGE},
+    {"region",		syn_cmd_region,		SYNCMD_CHANGE},
+    {"sync",		syn_cmd_sync,		SYNCMD_ARG},
+#ifdef SYN_TIME
+    {"time",		syn_cmd_time,		SYNCMD_LIST},
+#endif
+    {"",		syn_cmd_list,		SYNCMD_LIST},
+    {NULL, NULL, SYNCMD_LIST}
 };
 
 /*
@@ -4568,6 +5637,7 @@ do_syntax(eap, cmdlinep)
     char_u	*subcmd_end;
     char_u	*subcmd_name;
     int		i;
+    int		changes;
 
     syn_cmdlinep = cmdlinep;
 
@@ -4589,7 +5659,16 @@ do_syntax(eap, cmdlinep)
 	    if (STRCMP(subcmd_name, (char_u *)subcommands[i].name) == 0)
 	    {
 		eap->arg = skipwhite(subcmd_end);
+		changes = subcommands[i].changes;
+		if (changes == SYNCMD_ARG && ends_excmd(*eap->arg))
+		    changes = SYNCMD_LIST;
 		(subcommands[i].func)(eap, FALSE);
+		/* the items may have changed, the kept states are useless */
+		if (!eap->skip && changes != SYNCMD_LIST)
+		{
+		    syn_chk_free(curbuf);
+		    syn_attr_free(curbuf);
+		}
 		break;
 	    }
 	}
@@ -4686,7 +5765,7 @@ syn_get_id(line, col, trans)
 			   || col < (long)current_col || line != current_lnum)
 	syntax_start(curwin, line);
 
-    (void)get_syntax_attr((colnr_t)col, ml_get((linenr_t)line));
+    (void)syn_attr_at((colnr_t)col, ml_get((linenr_t)line));
 
     return (trans ? current_trans_id : current_id);
 }
@@ -4695,20 +5774,44 @@ syn_get_id(line, col, trans)
 /*
  * Call vim_regexec() with the current buffer set to syn_buf.  Makes
  * vim_iswordc() work correctly.
+ * When ":syntax time on" was used, counts the call in "st", if not NULL.
  */
     static int
-syn_regexec(prog, string, at_bol)
-    vim_regexp	*prog;
-    char_u	*string;
-    int		at_bol;
+syn_regexec(prog, string, at_bol, st)
+    vim_regexp		*prog;
+    char_u		*string;
+    int			at_bol;
+    struct syn_time	*st;
 {
     int		retval;
     BUF		*save_curbuf;
+#ifdef SYN_TIME
+    struct timeval	start, end;
+    long		usec;
+
+    if (syn_time_on && st != NULL)
+	gettimeofday(&start, NULL);
+#endif
 
     save_curbuf = curbuf;
     curbuf = syn_buf;
     retval = vim_regexec(prog, string, at_bol);
     curbuf = save_curbuf;
+
+#ifdef SYN_TIME
+    if (syn_time_on && st != NULL)
+    {
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - start.tv_sec) * 1000000L
+					       + (end.tv_usec - start.tv_usec);
+	st->st_total += usec;
+	if (usec > st->st_slowest)
+	    st->st_slowest = usec;
+	++st->st_count;
+	if (retval)
+	    ++st->st_match;
+    }
+#endif
     return retval;
 }
 
@@ -154,6 +154,16 @@ ui_inchar(buf, maxlen, wtime)
     }
 #endif
 
+    /* Use the time until the user types something to read more lines of a
+     * large file. */
+    if (wtime != 0)
+	readfile_idle();
+#ifdef FEAT_SYN_HL
+    /* And to parse the syntax below the window. */
+    if (wtime != 0)
+	syntax_idle();
+#endif
+
     /* When doing a blocking wait there is no need for CTRL-C to interrupt
      * something, don't let it set got_int when it was mapped. */
     if (mapped_ctrl_c && (wtime == -1 || wtime > 100L))
@@ -43,6 +43,11 @@
  *
  * All data is allocated with u_alloc_line(), thus it will be freed as soon as
  * we switch files!
+ *
+ * When 'undomem' is set, the entry lists of the oldest headers are written to
+ * a spill file once the undo memory of the buffer goes over it.  Such a
+ * header has a NULL uh_entry and uh_spill is the offset of its entries in the
+ * file.  The entries are read back when the header is undone.
  */
 
 #include "vim.h"
@@ -50,14 +55,28 @@
 static u_entry_T *u_get_headentry __ARGS((void));
 static void u_getbot __ARGS((void));
 static int u_savecommon __ARGS((linenr_T, linenr_T, linenr_T));
+static int u_merge_entry __ARGS((linenr_T top, linenr_T bot, linenr_T newbot));
 static void u_doit __ARGS((int count));
 static void u_undoredo __ARGS((void));
 static void u_undo_end __ARGS((void));
 static void u_freelist __ARGS((struct u_header *));
 static void u_freeentry __ARGS((u_entry_T *, long));
+static void u_delta_head __ARGS((u_header_T *uhp));
+static colnr_T u_delta_split __ARGS((char_u *old, char_u *cur, colnr_T *prep, colnr_T *sufp));
+static int u_numlen __ARGS((colnr_T n));
+static void u_delta_entry __ARGS((u_entry_T *uep));
+static void u_undelta_entry __ARGS((u_entry_T *uep));
+static unsigned u_spill_len __ARGS((char_u *p, int delta));
+static int u_spill_head __ARGS((u_header_T *uhp));
+static int u_unspill_head __ARGS((u_header_T *uhp));
+static void u_spill_drop __ARGS((void));
+static void u_spill_close __ARGS((buf_T *buf));
 
 static char_u *u_blockalloc __ARGS((long_u));
-static void u_free_line __ARGS((char_u *, int keep));
+static int u_size_class __ARGS((unsigned size));
+static unsigned u_class_size __ARGS((int c));
+static int u_new_slab __ARGS((void));
+static void u_free_line __ARGS((char_u *));
 static char_u *u_alloc_line __ARGS((unsigned));
 static char_u *u_save_line __ARGS((linenr_T));
 
@@ -202,6 +221,14 @@ u_savecommon(top, bot, newbot)
     change_warning(0);
 #endif
 
+    /*
+     * When the file was not read completely, get the rest of the lines
+     * before saving anything.  Appending lines later would change the line
+     * count that ue_lcount and a zero ue_bot depend on.
+     */
+    if (curbuf->b_ml.ml_lazy != NULL)
+	readfile_lazy(curbuf, (linenr_T)MAXLNUM);
+
     size = bot - top - 1;
 
     /*
@@ -225,6 +252,21 @@ u_savecommon(top, bot, newbot)
 	if (p_ul < 0)		/* no undo at all */
 	    return OK;
 
+	/*
+	 * move the entry lists of the oldest headers to the spill file while
+	 * undo uses more memory than 'undomem'
+	 */
+	if (curbuf->b_p_um > 0 && !curbuf->b_u_spill_err)
+	    for (uhp = curbuf->b_u_oldhead; uhp != NULL
+		    && curbuf->b_m_used > (long_u)curbuf->b_p_um * 1024;
+							    uhp = uhp->uh_prev)
+		if (uhp->uh_entry != NULL && u_spill_head(uhp) == FAIL)
+		{
+		    EMSG(_("E625: Cannot write undo spill file"));
+		    curbuf->b_u_spill_err = TRUE;
+		    break;
+		}
+
 	/*
 	 * make a new header entry
 	 */
@@ -238,6 +280,7 @@ u_savecommon(top, bot, newbot)
 	    curbuf->b_u_newhead->uh_prev = uhp;
 	uhp->uh_entry = NULL;
 	uhp->uh_getbot_entry = NULL;
+	uhp->uh_spill = -1;
 	uhp->uh_cursor = curwin->w_cursor;	/* save cursor pos. for undo */
 #ifdef FEAT_VIRTUALEDIT
 	if (virtual_active() && curwin->w_cursor.coladd > 0)
@@ -329,6 +372,19 @@ u_savecommon(top, bot, newbot)
 	    }
 	}
 
+	/*
+	 * When the lines are next to or overlap the lines of the last entry,
+	 * add them to that entry.  A script that changes lines one by one
+	 * then only creates one entry.  Also for a replaced line (":s",
+	 * SetBufferLine()), where "newbot" is "bot".
+	 */
+	if ((newbot == 0 || newbot == bot) && size > 0
+					  && u_merge_entry(top, bot, newbot) == OK)
+	{
+	    undo_undoes = FALSE;
+	    return OK;
+	}
+
 	/* find line number for ue_bot for previous u_save() */
 	u_getbot();
     }
@@ -350,7 +406,10 @@ u_savecommon(top, bot, newbot)
 	goto nomem;
 
     uep->ue_size = size;
+    uep->ue_room = 0;
     uep->ue_top = top;
+    uep->ue_delta = FALSE;
+    uep->ue_lcount = curbuf->b_ml.ml_line_count;
     if (newbot != 0)
 	uep->ue_bot = newbot;
     /*
@@ -360,10 +419,7 @@ u_savecommon(top, bot, newbot)
     else if (bot > curbuf->b_ml.ml_line_count)
 	uep->ue_bot = 0;
     else
-    {
-	uep->ue_lcount = curbuf->b_ml.ml_line_count;
 	curbuf->b_u_newhead->uh_getbot_entry = uep;
-    }
 
     if (size)
     {
@@ -373,6 +429,7 @@ u_savecommon(top, bot, newbot)
 	    u_freeentry(uep, 0L);
 	    goto nomem;
 	}
+	uep->ue_room = size;
 	for (i = 0, lnum = top + 1; i < size; ++i)
 	{
 	    if ((uep->ue_array[i] = u_save_line(lnum++)) == NULL)
@@ -401,6 +458,119 @@ nomem:
     return FAIL;
 }
 
+/*
+ * Try adding the lines between "top" and "bot" to the last entry of the
+ * current undo block.  This is possible when the number of lines didn't
+ * change since the entry was made and the lines are next to or overlap the
+ * lines of the entry.  Lines not in the entry can't have been changed since
+ * it was made, thus saving them now gives the same result.  Lines already
+ * in the entry are not saved again.
+ * "newbot" is zero or "bot" for a replaced line.  An entry with a fixed
+ * ue_bot can only take replaced lines, it then keeps a fixed ue_bot.
+ * ue_array grows by doubling, so that changing N lines one by one costs
+ * O(N) and not O(N * N).
+ * Returns FAIL when not possible or out of memory.
+ */
+    static int
+u_merge_entry(top, bot, newbot)
+    linenr_T	top;
+    linenr_T	bot;
+    linenr_T	newbot;
+{
+    u_entry_T	*uep;
+    linenr_T	otop, obot;
+    linenr_T	ntop, nbot;
+    linenr_T	lnum;
+    long	nsize;
+    long	room;
+    long	shift;
+    long	i;
+    int		getbot;
+    char_u	**newarray;
+
+    uep = curbuf->b_u_newhead->uh_entry;
+    if (uep == NULL || uep->ue_delta
+	    || uep->ue_lcount != curbuf->b_ml.ml_line_count)
+	return FAIL;
+    otop = uep->ue_top;
+    obot = otop + uep->ue_size + 1;
+    getbot = (curbuf->b_u_newhead->uh_getbot_entry == uep);
+    if (!getbot && (newbot == 0 || uep->ue_bot != obot))
+	return FAIL;
+    if (top >= obot || bot <= otop)
+	return FAIL;		/* not next to or overlapping */
+
+    ntop = top < otop ? top : otop;
+    nbot = bot > obot ? bot : obot;
+    nsize = nbot - ntop - 1;
+    if (nsize > uep->ue_size)
+    {
+	shift = otop - ntop;		/* number of new lines above */
+	if (nsize > uep->ue_room)
+	{
+	    room = uep->ue_room * 2;
+	    if (room < nsize)
+		room = nsize;
+#if !defined(UNIX) && !defined(DJGPP) && !defined(WIN32) && !defined(__EMX__)
+	    if (nsize >= 8000)
+		return FAIL;
+	    if (room >= 8000)
+		room = nsize;
+#endif
+	    newarray = (char_u **)u_alloc_line(
+					 (unsigned)(sizeof(char_u *) * room));
+	    if (newarray == NULL)
+		return FAIL;
+	    if (uep->ue_size > 0)
+		mch_memmove(newarray + shift, uep->ue_array,
+				      (size_t)uep->ue_size * sizeof(char_u *));
+	}
+	else
+	{
+	    room = uep->ue_room;
+	    newarray = uep->ue_array;
+	    if (shift > 0 && uep->ue_size > 0)
+		mch_memmove(newarray + shift, newarray,
+				      (size_t)uep->ue_size * sizeof(char_u *));
+	}
+
+	/* save the lines that are not in the entry yet */
+	for (i = 0, lnum = ntop + 1; i < nsize; ++i, ++lnum)
+	{
+	    if ((lnum <= otop || lnum >= obot)
+				 && (newarray[i] = u_save_line(lnum)) == NULL)
+	    {
+		/* free the lines saved here and put the array back */
+		while (--i >= 0)
+		    if (ntop + 1 + i <= otop || ntop + 1 + i >= obot)
+			u_free_line(newarray[i]);
+		if (newarray != uep->ue_array)
+		    u_free_line((char_u *)newarray);
+		else if (shift > 0 && uep->ue_size > 0)
+		    mch_memmove(newarray, newarray + shift,
+				      (size_t)uep->ue_size * sizeof(char_u *));
+		return FAIL;
+	    }
+	}
+	if (newarray != uep->ue_array && uep->ue_room > 0)
+	    u_free_line((char_u *)uep->ue_array);
+	uep->ue_array = newarray;
+	uep->ue_room = room;
+	uep->ue_top = ntop;
+	uep->ue_size = nsize;
+    }
+
+    if (!getbot)
+	uep->ue_bot = uep->ue_top + uep->ue_size + 1;
+    /* Use 0 for ue_bot if bot is below the last line, like u_savecommon(). */
+    else if (nbot > curbuf->b_ml.ml_line_count)
+    {
+	uep->ue_bot = 0;
+	curbuf->b_u_newhead->uh_getbot_entry = NULL;
+    }
+    return OK;
+}
+
 /*
  * If 'cpoptions' contains 'u': Undo the previous undo or redo (vi compatible).
  * If 'cpoptions' does not contain 'u': Always undo.
@@ -481,6 +651,12 @@ u_doit(count)
 		beep_flush();
 		break;
 	    }
+	    if (u_unspill_head(curbuf->b_u_curhead) == FAIL)
+	    {
+		/* this one wasn't undone */
+		curbuf->b_u_curhead = curbuf->b_u_curhead->uh_prev;
+		break;
+	    }
 
 	    u_undoredo();
 	}
@@ -491,6 +667,8 @@ u_doit(count)
 		beep_flush();	/* nothing to redo */
 		break;
 	    }
+	    if (u_unspill_head(curbuf->b_u_curhead) == FAIL)
+		break;
 
 	    u_undoredo();
 	    /* advance for next redo */
@@ -523,6 +701,8 @@ u_undoredo()
     int		new_flags;
     pos_T	namedm[NMARKS];
     int		empty_buffer;		    /* buffer became empty */
+    linenr_T	chg_top = 0;		    /* changed lines not reported */
+    linenr_T	chg_bot = 0;		    /* yet, 0 when none */
 
     old_flags = curbuf->b_u_curhead->uh_flags;
     new_flags = (curbuf->b_changed ? UH_CHANGED : 0) +
@@ -546,6 +726,8 @@ u_undoredo()
 	    bot = curbuf->b_ml.ml_line_count + 1;
 	if (top > curbuf->b_ml.ml_line_count || top >= bot || bot > curbuf->b_ml.ml_line_count + 1)
 	{
+	    if (chg_bot != 0)
+		changed_lines(chg_top, 0, chg_bot, 0L);
 	    EMSG(_("E438: u_undo: line numbers wrong"));
 	    changed();		/* don't want UNCHANGED now */
 	    return;
@@ -559,8 +741,26 @@ u_undoredo()
 	oldsize = bot - top - 1;    /* number of lines before undo */
 	newsize = uep->ue_size;	    /* number of lines after undo */
 
+	/* get the full lines back, while the lines they were made from are
+	 * still there */
+	if (uep->ue_delta)
+	    u_undelta_entry(uep);
+
 	empty_buffer = FALSE;
 
+	/*
+	 * Entries that don't change the number of lines and are next to
+	 * each other (e.g., made by ":%s") are reported with one
+	 * changed_lines() call, which updates the windows, folds and diffs.
+	 * Report the collected lines before the line numbers change.
+	 */
+	if (chg_bot != 0 && (oldsize != newsize
+				       || top + 1 > chg_bot || bot < chg_top))
+	{
+	    changed_lines(chg_top, 0, chg_bot, 0L);
+	    chg_bot = 0;
+	}
+
 	/* delete the lines between top and bot and save them in newarray */
 	if (oldsize)
 	{
@@ -580,36 +780,35 @@ u_undoredo()
 		}
 		break;
 	    }
-	    /* delete backwards, it goes faster in most cases */
 	    for (lnum = bot - 1, i = oldsize; --i >= 0; --lnum)
 	    {
 		/* what can we do when we run out of memory? */
 		if ((newarray[i] = u_save_line(lnum)) == NULL)
 		    do_outofmem_msg((long_u)0);
-		/* remember we deleted the last line in the buffer, and a
-		 * dummy empty line will be inserted */
-		if (curbuf->b_ml.ml_line_count == 1)
-		    empty_buffer = TRUE;
-		ml_delete(lnum, FALSE);
 	    }
+	    /* remember we delete the last line in the buffer, and a
+	     * dummy empty line will be inserted */
+	    if (curbuf->b_ml.ml_line_count == oldsize)
+		empty_buffer = TRUE;
+	    (void)ml_delete_range(top + 1, oldsize, FALSE);
 	}
 
 	/* insert the lines in u_array between top and bot */
 	if (newsize)
 	{
-	    for (lnum = top, i = 0; i < newsize; ++i, ++lnum)
-	    {
-		/*
-		 * If the file is empty, there is an empty line 1 that we
-		 * should get rid of, by replacing it with the new line
-		 */
-		if (empty_buffer && lnum == 0)
-		    ml_replace((linenr_T)1, uep->ue_array[i], TRUE);
-		else
-		    ml_append(lnum, uep->ue_array[i], (colnr_T)0, FALSE);
-		u_free_line(uep->ue_array[i], FALSE);
-	    }
-	    u_free_line((char_u *)uep->ue_array, FALSE);
+	    i = 0;
+	    /*
+	     * If the file is empty, there is an empty line 1 that we
+	     * should get rid of, by replacing it with the new line
+	     */
+	    if (empty_buffer && top == 0)
+		ml_replace((linenr_T)1, uep->ue_array[i++], TRUE);
+	    if (i < newsize)
+		(void)ml_append_lines(top + (linenr_T)i, uep->ue_array + i,
+						   NULL, newsize - i, FALSE);
+	    for (i = 0; i < newsize; ++i)
+		u_free_line(uep->ue_array[i]);
+	    u_free_line((char_u *)uep->ue_array);
 	}
 
 	/* adjust marks */
@@ -623,7 +822,20 @@ u_undoredo()
 		curbuf->b_op_end.lnum += newsize - oldsize;
 	}
 
-	changed_lines(top + 1, 0, bot, newsize - oldsize);
+	if (oldsize != newsize)
+	    changed_lines(top + 1, 0, bot, newsize - oldsize);
+	else if (chg_bot == 0)
+	{
+	    chg_top = top + 1;
+	    chg_bot = bot;
+	}
+	else
+	{
+	    if (top + 1 < chg_top)
+		chg_top = top + 1;
+	    if (bot > chg_bot)
+		chg_bot = bot;
+	}
 
 	/* set '[ and '] mark */
 	if (top + 1 < curbuf->b_op_start.lnum)
@@ -636,7 +848,9 @@ u_undoredo()
 	u_newcount += newsize;
 	u_oldcount += oldsize;
 	uep->ue_size = oldsize;
+	uep->ue_room = oldsize;
 	uep->ue_array = newarray;
+	uep->ue_delta = FALSE;
 	uep->ue_bot = top + newsize + 1;
 
 	/*
@@ -647,6 +861,9 @@ u_undoredo()
 	newlist = uep;
     }
 
+    if (chg_bot != 0)
+	changed_lines(chg_top, 0, chg_bot, 0L);
+
     curbuf->b_u_curhead->uh_entry = newlist;
     curbuf->b_u_curhead->uh_flags = new_flags;
     if ((old_flags & UH_EMPTYBUF) && bufempty())
@@ -735,6 +952,407 @@ u_sync()
 	return;		    /* already synced */
     u_getbot();		    /* compute ue_bot of previous u_save */
     curbuf->b_u_curhead = NULL;
+    if (curbuf->b_u_newhead != NULL)
+	u_delta_head(curbuf->b_u_newhead);
+}
+
+/*
+ * Store the saved lines of the entries in header "uhp" as deltas against the
+ * current text where that takes less memory.  Only done for the header that
+ * was just finished, the buffer text then is what it will be when undoing
+ * it.  The deltas are turned back into lines by u_undelta_entry().
+ *
+ * Undo handles the entries in list order.  An entry can only use deltas
+ * when the entries before it in the list didn't change the number of lines
+ * and are below its lines, thus undoing them doesn't change its lines.
+ * That is what a ":%s" produces: one entry for each changed line.
+ */
+    static void
+u_delta_head(uhp)
+    u_header_T	*uhp;
+{
+    u_entry_T	*uep;
+    linenr_T	bot;
+    linenr_T	min_top = MAXLNUM;
+
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+    {
+	bot = uep->ue_bot;
+	if (bot == 0)
+	    bot = curbuf->b_ml.ml_line_count + 1;
+	if (bot - uep->ue_top - 1 != uep->ue_size)
+	    break;		/* number of lines changed */
+	if (uep->ue_size > 0 && !uep->ue_delta && bot - 1 <= min_top)
+	    u_delta_entry(uep);
+	if (uep->ue_top < min_top)
+	    min_top = uep->ue_top;
+    }
+}
+
+/*
+ * Find the length of the text that saved line "old" and current line "cur"
+ * have in common at the start and, in the rest, at the end.
+ * Returns the length of "old".
+ */
+    static colnr_T
+u_delta_split(old, cur, prep, sufp)
+    char_u	*old;
+    char_u	*cur;
+    colnr_T	*prep;
+    colnr_T	*sufp;
+{
+    colnr_T	oldlen = (colnr_T)STRLEN(old);
+    colnr_T	curlen = (colnr_T)STRLEN(cur);
+    colnr_T	pre, suf;
+
+    for (pre = 0; pre < oldlen && pre < curlen && old[pre] == cur[pre]; ++pre)
+	;
+    for (suf = 0; suf < oldlen - pre && suf < curlen - pre
+			&& old[oldlen - 1 - suf] == cur[curlen - 1 - suf]; ++suf)
+	;
+    *prep = pre;
+    *sufp = suf;
+    return oldlen;
+}
+
+/*
+ * Return the number of bytes used to store "n" in a delta: seven bits in
+ * each byte, the high bit set when more bytes follow.
+ */
+    static int
+u_numlen(n)
+    colnr_T	n;
+{
+    int		len = 1;
+
+    while ((n >>= 7) != 0)
+	++len;
+    return len;
+}
+
+/*
+ * Replace the saved lines of entry "uep" with deltas against the current
+ * lines ue_top + 1 and following.  A delta is the length of the common
+ * start, the length of the common end and the differing text of the saved
+ * line, NUL terminated.
+ * Nothing is changed when the deltas don't take less memory or when out of
+ * memory.
+ */
+    static void
+u_delta_entry(uep)
+    u_entry_T	*uep;
+{
+    long	i;
+    long	oldbytes = 0;
+    long	newbytes = 0;
+    colnr_T	oldlen, pre, suf, n;
+    char_u	*p, *q;
+    char_u	**newarray;
+
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	oldlen = u_delta_split(uep->ue_array[i],
+			       ml_get(uep->ue_top + 1 + (linenr_T)i), &pre, &suf);
+	oldbytes += oldlen;
+	newbytes += u_numlen(pre) + u_numlen(suf) + oldlen - pre - suf;
+    }
+    if (newbytes >= oldbytes)
+	return;
+
+    newarray = (char_u **)u_alloc_line(
+				 (unsigned)(sizeof(char_u *) * uep->ue_size));
+    if (newarray == NULL)
+	return;
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	oldlen = u_delta_split(uep->ue_array[i],
+			       ml_get(uep->ue_top + 1 + (linenr_T)i), &pre, &suf);
+	p = u_alloc_line((unsigned)(u_numlen(pre) + u_numlen(suf)
+							 + oldlen - pre - suf));
+	if (p == NULL)
+	{
+	    while (--i >= 0)
+		u_free_line(newarray[i]);
+	    u_free_line((char_u *)newarray);
+	    return;
+	}
+	q = p;
+	for (n = pre; n >= 0x80; n >>= 7)
+	    *q++ = (char_u)((n & 0x7f) | 0x80);
+	*q++ = (char_u)n;
+	for (n = suf; n >= 0x80; n >>= 7)
+	    *q++ = (char_u)((n & 0x7f) | 0x80);
+	*q++ = (char_u)n;
+	mch_memmove(q, uep->ue_array[i] + pre, (size_t)(oldlen - pre - suf));
+	q[oldlen - pre - suf] = NUL;
+	newarray[i] = p;
+    }
+
+    for (i = 0; i < uep->ue_size; ++i)
+	u_free_line(uep->ue_array[i]);
+    u_free_line((char_u *)uep->ue_array);
+    uep->ue_array = newarray;
+    uep->ue_room = uep->ue_size;
+    uep->ue_delta = TRUE;
+}
+
+/*
+ * Turn the deltas in entry "uep" back into lines, using the current lines
+ * ue_top + 1 and following.  Out of memory is handled like u_save_line()
+ * does: the line is replaced with an empty one.
+ */
+    static void
+u_undelta_entry(uep)
+    u_entry_T	*uep;
+{
+    long	i;
+    char_u	*cur;
+    char_u	*p, *q;
+    colnr_T	curlen, pre, suf, mid;
+    int		shift;
+
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	p = uep->ue_array[i];
+	pre = 0;
+	for (shift = 0; *p & 0x80; shift += 7)
+	    pre |= (colnr_T)(*p++ & 0x7f) << shift;
+	pre |= (colnr_T)*p++ << shift;
+	suf = 0;
+	for (shift = 0; *p & 0x80; shift += 7)
+	    suf |= (colnr_T)(*p++ & 0x7f) << shift;
+	suf |= (colnr_T)*p++ << shift;
+	mid = (colnr_T)STRLEN(p);
+
+	cur = ml_get(uep->ue_top + 1 + (linenr_T)i);
+	curlen = (colnr_T)STRLEN(cur);
+	/* Only when the text was changed without saving it for undo. */
+	if (pre > curlen)
+	    pre = curlen;
+	if (suf > curlen - pre)
+	    suf = curlen - pre;
+
+	q = u_alloc_line((unsigned)(pre + mid + suf));
+	if (q == NULL)
+	{
+	    do_outofmem_msg((long_u)0);
+	    *IObuff = NUL;	/* u_free_line() ignores IObuff */
+	    q = IObuff;
+	}
+	else
+	{
+	    mch_memmove(q, cur, (size_t)pre);
+	    mch_memmove(q + pre, p, (size_t)mid);
+	    mch_memmove(q + pre + mid, cur + curlen - suf, (size_t)suf);
+	    q[pre + mid + suf] = NUL;
+	}
+	u_free_line(uep->ue_array[i]);
+	uep->ue_array[i] = q;
+    }
+    uep->ue_delta = FALSE;
+}
+
+/*
+ * Return the number of bytes in saved line "p", without the NUL.  When
+ * "delta" is TRUE the lengths at the start of the delta may have NUL bytes.
+ */
+    static unsigned
+u_spill_len(p, delta)
+    char_u	*p;
+    int		delta;
+{
+    char_u	*s = p;
+    int		n;
+
+    if (delta)
+	for (n = 0; n < 2; ++n)
+	{
+	    while (*s & 0x80)
+		++s;
+	    ++s;
+	}
+    return (unsigned)(s - p + STRLEN(s));
+}
+
+/*
+ * Write the entry list of header "uhp" to the spill file of the current
+ * buffer and free it.  The file is created when needed.
+ * Returns FAIL when the file can't be written, the entries are then kept.
+ */
+    static int
+u_spill_head(uhp)
+    u_header_T	*uhp;
+{
+    FILE	*fd;
+    u_entry_T	*uep, *nuep;
+    long	count = 0;
+    long	off;
+    long	i;
+    unsigned	len;
+
+    if (curbuf->b_u_spill_fd == NULL)
+    {
+	if ((curbuf->b_u_spill_fname = vim_tempname('u')) == NULL)
+	    return FAIL;
+	curbuf->b_u_spill_fd = mch_fopen((char *)curbuf->b_u_spill_fname,
+									"w+b");
+	if (curbuf->b_u_spill_fd == NULL)
+	{
+	    vim_free(curbuf->b_u_spill_fname);
+	    curbuf->b_u_spill_fname = NULL;
+	    return FAIL;
+	}
+    }
+    fd = curbuf->b_u_spill_fd;
+
+    /* Append to the file.  What a failed write leaves at the end is not
+     * used, it goes away with the file. */
+    if (fseek(fd, 0L, SEEK_END) != 0 || (off = ftell(fd)) < 0)
+	return FAIL;
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+	++count;
+    if (fwrite(&count, sizeof(count), 1, fd) != 1)
+	return FAIL;
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+    {
+	if (fwrite(&uep->ue_top, sizeof(linenr_T), 1, fd) != 1
+		|| fwrite(&uep->ue_bot, sizeof(linenr_T), 1, fd) != 1
+		|| fwrite(&uep->ue_lcount, sizeof(linenr_T), 1, fd) != 1
+		|| fwrite(&uep->ue_size, sizeof(long), 1, fd) != 1
+		|| fwrite(&uep->ue_delta, sizeof(int), 1, fd) != 1)
+	    return FAIL;
+	for (i = 0; i < uep->ue_size; ++i)
+	{
+	    len = u_spill_len(uep->ue_array[i], uep->ue_delta);
+	    if (fwrite(&len, sizeof(len), 1, fd) != 1
+		    || fwrite(uep->ue_array[i], (size_t)1, (size_t)len, fd)
+								       != len)
+		return FAIL;
+	}
+    }
+    if (fflush(fd) != 0)
+	return FAIL;
+
+    for (uep = uhp->uh_entry; uep != NULL; uep = nuep)
+    {
+	nuep = uep->ue_next;
+	u_freeentry(uep, uep->ue_size);
+    }
+    uhp->uh_entry = NULL;
+    uhp->uh_spill = off;
+    ++curbuf->b_u_spilled;
+    return OK;
+}
+
+/*
+ * Read the entry list of header "uhp" back from the spill file, when it was
+ * written there.
+ * Returns FAIL and gives a message when it can't be read.
+ */
+    static int
+u_unspill_head(uhp)
+    u_header_T	*uhp;
+{
+    FILE	*fd = curbuf->b_u_spill_fd;
+    u_entry_T	*uep;
+    u_entry_T	*first = NULL;
+    u_entry_T	*prev = NULL;
+    long	count;
+    long	size;
+    unsigned	len;
+    char_u	*p;
+
+    if (uhp->uh_spill < 0)
+	return OK;
+
+    if (fseek(fd, uhp->uh_spill, SEEK_SET) != 0
+				   || fread(&count, sizeof(count), 1, fd) != 1)
+	goto fail;
+    while (--count >= 0)
+    {
+	uep = (u_entry_T *)u_alloc_line((unsigned)sizeof(u_entry_T));
+	if (uep == NULL)
+	    goto fail;
+	uep->ue_next = NULL;
+	uep->ue_array = NULL;
+	uep->ue_size = 0;
+	uep->ue_room = 0;
+	if (prev == NULL)
+	    first = uep;
+	else
+	    prev->ue_next = uep;
+	prev = uep;
+
+	if (fread(&uep->ue_top, sizeof(linenr_T), 1, fd) != 1
+		|| fread(&uep->ue_bot, sizeof(linenr_T), 1, fd) != 1
+		|| fread(&uep->ue_lcount, sizeof(linenr_T), 1, fd) != 1
+		|| fread(&size, sizeof(long), 1, fd) != 1
+		|| fread(&uep->ue_delta, sizeof(int), 1, fd) != 1)
+	    goto fail;
+	if (size > 0)
+	{
+	    uep->ue_array = (char_u **)u_alloc_line(
+				       (unsigned)(sizeof(char_u *) * size));
+	    if (uep->ue_array == NULL)
+		goto fail;
+	    uep->ue_room = size;
+	}
+	/* ue_size counts the lines read, for freeing on failure */
+	while (uep->ue_size < size)
+	{
+	    if (fread(&len, sizeof(len), 1, fd) != 1
+				       || (p = u_alloc_line(len)) == NULL)
+		goto fail;
+	    uep->ue_array[uep->ue_size++] = p;
+	    if (fread(p, (size_t)1, (size_t)len, fd) != len)
+		goto fail;
+	    p[len] = NUL;
+	}
+    }
+
+    uhp->uh_entry = first;
+    uhp->uh_spill = -1;
+    u_spill_drop();
+    return OK;
+
+fail:
+    while (first != NULL)
+    {
+	uep = first->ue_next;
+	u_freeentry(first, first->ue_size);
+	first = uep;
+    }
+    EMSG(_("E626: Cannot read undo spill file"));
+    return FAIL;
+}
+
+/*
+ * A header of the current buffer no longer has its entries in the spill
+ * file.  Delete the file when no header uses it.
+ */
+    static void
+u_spill_drop()
+{
+    if (--curbuf->b_u_spilled == 0)
+	u_spill_close(curbuf);
+}
+
+/*
+ * Close and delete the spill file of buffer "buf".
+ */
+    static void
+u_spill_close(buf)
+    buf_T	*buf;
+{
+    if (buf->b_u_spill_fd != NULL)
+    {
+	fclose(buf->b_u_spill_fd);
+	mch_remove(buf->b_u_spill_fname);
+	buf->b_u_spill_fd = NULL;
+    }
+    vim_free(buf->b_u_spill_fname);
+    buf->b_u_spill_fname = NULL;
+    buf->b_u_spilled = 0;
 }
 
 /*
@@ -821,6 +1439,9 @@ u_freelist(uhp)
 	u_freeentry(uep, uep->ue_size);
     }
 
+    if (uhp->uh_spill >= 0)
+	u_spill_drop();
+
     if (curbuf->b_u_curhead == uhp)
 	curbuf->b_u_curhead = NULL;
 
@@ -834,7 +1455,7 @@ u_freelist(uhp)
     else
 	uhp->uh_prev->uh_next = uhp->uh_next;
 
-    u_free_line((char_u *)uhp, FALSE);
+    u_free_line((char_u *)uhp);
     --curbuf->b_u_numhead;
 }
 
@@ -847,8 +1468,10 @@ u_freeentry(uep, n)
     long	    n;
 {
     while (n)
-	u_free_line(uep->ue_array[--n], FALSE);
-    u_free_line((char_u *)uep, FALSE);
+	u_free_line(uep->ue_array[--n]);
+    if (uep->ue_room > 0)
+	u_free_line((char_u *)uep->ue_array);
+    u_free_line((char_u *)uep);
 }
 
 /*
@@ -861,6 +1484,8 @@ u_clearall(buf)
     buf->b_u_newhead = buf->b_u_oldhead = buf->b_u_curhead = NULL;
     buf->b_u_synced = TRUE;
     buf->b_u_numhead = 0;
+    u_spill_close(buf);
+    buf->b_u_spill_err = FALSE;
     buf->b_u_line_ptr = NULL;
     buf->b_u_line_lnum = 0;
 }
@@ -895,7 +1520,7 @@ u_clearline()
 {
     if (curbuf->b_u_line_ptr != NULL)
     {
-	u_free_line(curbuf->b_u_line_ptr, FALSE);
+	u_free_line(curbuf->b_u_line_ptr);
 	curbuf->b_u_line_ptr = NULL;
 	curbuf->b_u_line_lnum = 0;
     }
@@ -933,7 +1558,7 @@ u_undoline()
     }
     ml_replace(curbuf->b_u_line_lnum, curbuf->b_u_line_ptr, TRUE);
     changed_bytes(curbuf->b_u_line_lnum, 0);
-    u_free_line(curbuf->b_u_line_ptr, FALSE);
+    u_free_line(curbuf->b_u_line_ptr);
     curbuf->b_u_line_ptr = oldp;
 
     t = curbuf->b_u_line_colnr;
@@ -951,54 +1576,49 @@ u_undoline()
  * Memory is allocated in relatively large blocks. These blocks are linked
  * in the allocated block list, headed by curbuf->b_block_head. They are all
  * freed when abandoning a file, so we don't have to free every single line.
- * The list is kept sorted on memory address.
- * block_alloc() allocates a block.
- * m_blockfree() frees all blocks.
- *
- * The available chunks of memory are kept in free chunk lists. There is
- * one free list for each block of allocated memory. The list is kept sorted
- * on memory address.
- * u_alloc_line() gets a chunk from the free lists.
- * u_free_line() returns a chunk to the free lists.
- * curbuf->b_m_search points to the chunk before the chunk that was
- * freed/allocated the last time.
- * curbuf->b_mb_current points to the b_head where curbuf->b_m_search
- * points into the free list.
+ * u_blockalloc() allocates a block.
+ * u_blockfree() frees all blocks.
  *
+ * Chunks are handed out in size classes (see U_NCLASSES).  Each class has
+ * its own free list, thus allocating and freeing a chunk is a matter of
+ * taking it from or putting it in front of a list, no matter how many
+ * chunks there are.  When the free list of a class is empty, a new chunk is
+ * cut off from the current slab block (curbuf->b_m_slab).
+ * Chunks larger than U_SLAB_MAX get a block of their own, which is freed
+ * again when the chunk is freed.
+ * u_alloc_line() gets a chunk.
+ * u_free_line() returns a chunk.
  *
  *  b_block_head     /---> block #1	/---> block #2
  *	 mb_next ---/	    mb_next ---/       mb_next ---> NULL
- *	 mb_info	    mb_info	       mb_info
- *	    |		       |		  |
- *	    V		       V		  V
- *	  NULL		free chunk #1.1      free chunk #2.1
- *			       |		  |
- *			       V		  V
- *			free chunk #1.2		 NULL
- *			       |
- *			       V
- *			      NULL
+ *	 NULL <--------------- mb_prev  <------------ mb_prev
  *
- * When a single free chunk list would have been used, it could take a lot
- * of time in u_free_line() to find the correct place to insert a chunk in the
- * free list. The single free list would become very long when many lines are
- * changed (e.g. with :%s/^M$//).
+ *  b_m_free[0] ---> free chunk ---> free chunk ---> NULL
+ *  b_m_free[1] ---> NULL
+ *  ...
+ *
+ * The chunks in the slab blocks are not given back one by one, when
+ * :%s/^M$// changed all lines the next change is likely to need the memory
+ * again.  When no chunk is in use anymore, e.g. after the undo history was
+ * cleared, all slabs are released.
  */
 
  /*
-  * this blocksize is used when allocating new lines
+  * this blocksize is used when allocating a new slab
   */
-#define MEMBLOCKSIZE 2044
+#define MEMBLOCKSIZE 8192
 
 /*
  * The size field contains the size of the chunk, including the size field
- * itself.
+ * itself.  It is the size of the class, or the size of the block for chunks
+ * larger than U_SLAB_MAX.
  *
  * When the chunk is not in-use it is preceded with the m_info structure.
- * The m_next field links it in one of the free chunk lists.
+ * The m_next field links it in the free chunk list of its class.
  *
  * On most unix systems structures have to be longword (32 or 64 bit) aligned.
- * On most other systems they are short (16 bit) aligned.
+ * On most other systems they are short (16 bit) aligned.  The class sizes
+ * are multiples of U_CLASS_STEP, which keeps the chunks in a slab aligned.
  */
 
 /* the structure definitions are now in structs.h */
@@ -1011,6 +1631,37 @@ u_undoline()
 # define M_OFFSET (sizeof(short_u))
 #endif
 
+/*
+ * Return the size class for a chunk of "size" bytes, "size" must not be
+ * larger than U_SLAB_MAX.
+ */
+    static int
+u_size_class(size)
+    unsigned	size;
+{
+    int		c;
+    unsigned	n;
+
+    if (size <= U_CLASS_SMALL * U_CLASS_STEP)
+	return (int)((size - 1) / U_CLASS_STEP);
+    c = U_CLASS_SMALL;
+    for (n = U_CLASS_SMALL * U_CLASS_STEP * 2; n < size; n <<= 1)
+	++c;
+    return c;
+}
+
+/*
+ * Return the size of the chunks in class "c".
+ */
+    static unsigned
+u_class_size(c)
+    int		c;
+{
+    if (c < U_CLASS_SMALL)
+	return (unsigned)((c + 1) * U_CLASS_STEP);
+    return (unsigned)(U_CLASS_SMALL * U_CLASS_STEP) << (c - U_CLASS_SMALL + 1);
+}
+
 /*
  * Allocate a block of memory and link it in the allocated block list.
  */
@@ -1019,24 +1670,16 @@ u_blockalloc(size)
     long_u	size;
 {
     mblock_T	*p;
-    mblock_T	*mp, *next;
 
     p = (mblock_T *)lalloc(size + sizeof(mblock_T), FALSE);
     if (p != NULL)
     {
-	 /* Insert the block into the allocated block list, keeping it
-		    sorted on address. */
-	for (mp = &curbuf->b_block_head;
-		(next = mp->mb_next) != NULL && next < p;
-			mp = next)
-	    ;
-	p->mb_next = next;		/* link in block list */
+	p->mb_next = curbuf->b_block_head.mb_next;  /* link in block list */
+	p->mb_prev = &curbuf->b_block_head;
+	if (p->mb_next != NULL)
+	    p->mb_next->mb_prev = p;
+	curbuf->b_block_head.mb_next = p;
 	p->mb_size = size;
-	mp->mb_next = p;
-	p->mb_info.m_next = NULL;	/* clear free list */
-	p->mb_info.m_size = 0;
-	curbuf->b_mb_current = p;	/* remember current block */
-	curbuf->b_m_search = NULL;
 	p++;				/* return usable memory */
     }
     return (char_u *)p;
@@ -1050,6 +1693,7 @@ u_blockfree(buf)
     buf_T	*buf;
 {
     mblock_T	*p, *np;
+    int		c;
 
     for (p = buf->b_block_head.mb_next; p != NULL; p = np)
     {
@@ -1057,132 +1701,90 @@ u_blockfree(buf)
 	vim_free(p);
     }
     buf->b_block_head.mb_next = NULL;
-    buf->b_m_search = NULL;
-    buf->b_mb_current = NULL;
+    for (c = 0; c < U_NCLASSES; ++c)
+	buf->b_m_free[c] = NULL;
+    buf->b_m_slab = NULL;
+    buf->b_m_slab_left = 0;
+    buf->b_m_used = 0;
+}
+
+/*
+ * Put the rest of the current slab in the free lists and start a new slab.
+ * Returns FAIL when out of memory.
+ */
+    static int
+u_new_slab()
+{
+    minfo_T	*mp;
+    char_u	*p;
+    int		c;
+    unsigned	n;
+
+    while (curbuf->b_m_slab_left >= U_CLASS_STEP)
+    {
+	if (curbuf->b_m_slab_left >= U_SLAB_MAX)
+	    c = U_NCLASSES - 1;
+	else
+	{
+	    /* largest class that fits in what is left */
+	    c = u_size_class((unsigned)curbuf->b_m_slab_left);
+	    if (u_class_size(c) > curbuf->b_m_slab_left)
+		--c;
+	}
+	n = u_class_size(c);
+	mp = (minfo_T *)curbuf->b_m_slab;
+	mp->m_size = n;
+	mp->m_next = curbuf->b_m_free[c];
+	curbuf->b_m_free[c] = mp;
+	curbuf->b_m_slab += n;
+	curbuf->b_m_slab_left -= n;
+    }
+
+    p = u_blockalloc((long_u)MEMBLOCKSIZE);
+    if (p == NULL)
+	return FAIL;
+    curbuf->b_m_slab = p;
+    curbuf->b_m_slab_left = MEMBLOCKSIZE;
+    return OK;
 }
 
 /*
  * Free a chunk of memory for the current buffer.
- * Insert the chunk into the correct free list, keeping it sorted on address.
+ * Put the chunk in front of the free list of its class.
  */
     static void
-u_free_line(ptr, keep)
+u_free_line(ptr)
     char_u	*ptr;
-    int		keep;	/* don't free the block when it's empty */
 {
-    minfo_T	*next;
-    minfo_T	*prev, *curr;
     minfo_T	*mp;
-    mblock_T	*nextb;
-    mblock_T	*prevb;
+    mblock_T	*mbp;
+    int		c;
 
     if (ptr == NULL || ptr == IObuff)
 	return;	/* illegal address can happen in out-of-memory situations */
 
     mp = (minfo_T *)(ptr - M_OFFSET);
+    curbuf->b_m_used -= mp->m_size;
 
-    /* find block where chunk could be a part off */
-    /* if we change curbuf->b_mb_current, curbuf->b_m_search is set to NULL */
-    if (curbuf->b_mb_current == NULL || mp < (minfo_T *)curbuf->b_mb_current)
-    {
-	curbuf->b_mb_current = curbuf->b_block_head.mb_next;
-	curbuf->b_m_search = NULL;
-    }
-    if ((nextb = curbuf->b_mb_current->mb_next) != NULL
-						     && (minfo_T *)nextb < mp)
-    {
-	curbuf->b_mb_current = nextb;
-	curbuf->b_m_search = NULL;
-    }
-    while ((nextb = curbuf->b_mb_current->mb_next) != NULL
-						     && (minfo_T *)nextb < mp)
-	curbuf->b_mb_current = nextb;
-
-    curr = NULL;
-    /*
-     * If mp is smaller than curbuf->b_m_search->m_next go to the start of
-     * the free list
-     */
-    if (curbuf->b_m_search == NULL || mp < (curbuf->b_m_search->m_next))
-	next = &(curbuf->b_mb_current->mb_info);
-    else
-	next = curbuf->b_m_search;
-    /*
-     * The following loop is executed very often.
-     * Therefore it has been optimized at the cost of readability.
-     * Keep it fast!
-     */
-#ifdef SLOW_BUT_EASY_TO_READ
-    do
-    {
-	prev = curr;
-	curr = next;
-	next = next->m_next;
-    }
-    while (mp > next && next != NULL);
-#else
-    do					    /* first, middle, last */
-    {
-	prev = next->m_next;		    /* curr, next, prev */
-	if (prev == NULL || mp <= prev)
-	{
-	    prev = curr;
-	    curr = next;
-	    next = next->m_next;
-	    break;
-	}
-	curr = prev->m_next;		    /* next, prev, curr */
-	if (curr == NULL || mp <= curr)
-	{
-	    prev = next;
-	    curr = prev->m_next;
-	    next = curr->m_next;
-	    break;
-	}
-	next = curr->m_next;		    /* prev, curr, next */
-    }
-    while (mp > next && next != NULL);
-#endif
-
-    /* if *mp and *next are concatenated, join them into one chunk */
-    if ((char_u *)mp + mp->m_size == (char_u *)next)
+    if (mp->m_size > U_SLAB_MAX)
     {
-	mp->m_size += next->m_size;
-	mp->m_next = next->m_next;
+	/* chunk has a block of its own: unlink it and release it */
+	mbp = (mblock_T *)mp - 1;
+	mbp->mb_prev->mb_next = mbp->mb_next;
+	if (mbp->mb_next != NULL)
+	    mbp->mb_next->mb_prev = mbp->mb_prev;
+	vim_free(mbp);
     }
-    else
-	mp->m_next = next;
-
-    /* if *curr and *mp are concatenated, join them */
-    if (prev != NULL && (char_u *)curr + curr->m_size == (char_u *)mp)
+    else if (curbuf->b_m_used == 0)
     {
-	curr->m_size += mp->m_size;
-	curr->m_next = mp->m_next;
-	curbuf->b_m_search = prev;
+	/* Last chunk in use was freed: the slabs are empty, release them. */
+	u_blockfree(curbuf);
     }
     else
     {
-	curr->m_next = mp;
-	curbuf->b_m_search = curr;  /* put curbuf->b_m_search before freed
-				       chunk */
-    }
-
-    /*
-     * If the block only containes free memory now, release it.
-     */
-    if (!keep && curbuf->b_mb_current->mb_size
-			      == curbuf->b_mb_current->mb_info.m_next->m_size)
-    {
-	/* Find the block before the current one to be able to unlink it from
-	 * the list of blocks. */
-	prevb = &curbuf->b_block_head;
-	for (nextb = prevb->mb_next; nextb != curbuf->b_mb_current;
-						       nextb = nextb->mb_next)
-	    prevb = nextb;
-	prevb->mb_next = nextb->mb_next;
-	vim_free(nextb);
-	curbuf->b_mb_current = NULL;
-	curbuf->b_m_search = NULL;
+	c = u_size_class((unsigned)mp->m_size);
+	mp->m_next = curbuf->b_m_free[c];
+	curbuf->b_m_free[c] = mp;
     }
 }
 
@@ -1194,9 +1796,8 @@ u_free_line(ptr, keep)
 u_alloc_line(size)
     unsigned	size;
 {
-    minfo_T	*mp, *mprev, *mp2;
-    mblock_T	*mbp;
-    int		size_align;
+    minfo_T	*mp;
+    int		c;
 
     /*
      * Add room for size field and trailing NUL byte.
@@ -1207,78 +1808,34 @@ u_alloc_line(size)
     if (size < sizeof(minfo_T) + 1)
 	size = sizeof(minfo_T) + 1;
 
-    /*
-     * round size up for alignment
-     */
-    size_align = (size + ALIGN_MASK) & ~ALIGN_MASK;
-
-    /*
-     * If curbuf->b_m_search is NULL (uninitialized free list) start at
-     * curbuf->b_block_head
-     */
-    if (curbuf->b_mb_current == NULL || curbuf->b_m_search == NULL)
+    if (size > U_SLAB_MAX)
     {
-	curbuf->b_mb_current = &curbuf->b_block_head;
-	curbuf->b_m_search = &(curbuf->b_block_head.mb_info);
+	/* too big for a slab, use a block of its own */
+	size = (size + ALIGN_MASK) & ~ALIGN_MASK;
+	mp = (minfo_T *)u_blockalloc((long_u)size);
+	if (mp == NULL)
+	    return NULL;
+	mp->m_size = size;
     }
-
-    /* search for space in free list */
-    mprev = curbuf->b_m_search;
-    mbp = curbuf->b_mb_current;
-    mp = curbuf->b_m_search->m_next;
-    if (mp == NULL)
+    else
     {
-	if (mbp->mb_next)
-	    mbp = mbp->mb_next;
+	c = u_size_class(size);
+	mp = curbuf->b_m_free[c];
+	if (mp != NULL)
+	    curbuf->b_m_free[c] = mp->m_next;
 	else
-	    mbp = &curbuf->b_block_head;
-	mp = curbuf->b_m_search = &(mbp->mb_info);
-    }
-    while (mp->m_size < size)
-    {
-	if (mp == curbuf->b_m_search)	    /* back where we started in free
-					       chunk list */
 	{
-	    if (mbp->mb_next)
-		mbp = mbp->mb_next;
-	    else
-		mbp = &curbuf->b_block_head;
-	    mp = curbuf->b_m_search = &(mbp->mb_info);
-	    if (mbp == curbuf->b_mb_current)	/* back where we started in
-						   block list */
-	    {
-		int	n = (size_align > (MEMBLOCKSIZE / 4)
-						 ? size_align : MEMBLOCKSIZE);
-
-		mp = (minfo_T *)u_blockalloc((long_u)n);
-		if (mp == NULL)
-		    return (NULL);
-		mp->m_size = n;
-		u_free_line((char_u *)mp + M_OFFSET, TRUE);
-		mp = curbuf->b_m_search;
-		mbp = curbuf->b_mb_current;
-	    }
+	    /* free list is empty, cut a chunk from the slab */
+	    size = u_class_size(c);
+	    if (curbuf->b_m_slab_left < size && u_new_slab() == FAIL)
+		return NULL;
+	    mp = (minfo_T *)curbuf->b_m_slab;
+	    mp->m_size = size;
+	    curbuf->b_m_slab += size;
+	    curbuf->b_m_slab_left -= size;
 	}
-	mprev = mp;
-	if ((mp = mp->m_next) == NULL)	    /* at end of the list */
-	    mp = &(mbp->mb_info);	    /* wrap around to begin */
-    }
-
-    /* if the chunk we found is large enough, split it up in two */
-    if ((long)mp->m_size - size_align >= (long)(sizeof(minfo_T) + 1))
-    {
-	mp2 = (minfo_T *)((char_u *)mp + size_align);
-	mp2->m_size = mp->m_size - size_align;
-	mp2->m_next = mp->m_next;
-	mprev->m_next = mp2;
-	mp->m_size = size_align;
-    }
-    else		    /* remove *mp from the free list */
-    {
-	mprev->m_next = mp->m_next;
     }
-    curbuf->b_m_search = mprev;
-    curbuf->b_mb_current = mbp;
+    curbuf->b_m_used += mp->m_size;
 
     mp = (minfo_T *)((char_u *)mp + M_OFFSET);
     *(char_u *)mp = NUL;		    /* set the first byte to NUL */